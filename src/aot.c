@@ -0,0 +1,529 @@
+#include "aot.h"
+#include "exec.h"
+#include "global.h"
+#include "error.h"
+#include <limits.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/wait.h>
+
+
+#define AOT_EXPR_LEN 64
+#define AOT_GUARD_LEN 256
+
+//what an operand is translated to, and the condition that has to hold for that
+typedef struct _aot_expr_s {
+    char expr[AOT_EXPR_LEN], guard[AOT_GUARD_LEN];
+} aot_expr_s;
+
+
+static int aot_step_cb(void *prog);
+static void aot_load_cb(void *var, size_t idx, int *val);
+static void aot_store_cb(void *var, size_t idx, int val);
+static void aot_up_cb(void *var, size_t idx);
+static void aot_down_cb(void *prog, void *var, size_t idx);
+
+static int translate_operand(bytecode_image_s *img, const unsigned char *is_array,
+                             const operand_s *op, aot_expr_s *e);
+static int translate_global(bytecode_image_s *img, const unsigned char *is_array,
+                            const operand_s *op, aot_expr_s *e);
+static void add_guard(aot_expr_s *dst, const aot_expr_s *src);
+static int translate_instruction(FILE *out, bytecode_image_s *img,
+                                 const unsigned char *is_array, size_t pos);
+static int write_source(bytecode_image_s *img, const char *file, struct stat *st);
+static int build_object(const char *src, const char *obj);
+
+
+
+
+int aot_step_cb(void *prog)
+{
+    (void)interpret_next_lines((program_s*)prog, 1);
+
+    return ((program_s*)prog)->state == INSTRUCTION_LINE;
+}
+
+void aot_load_cb(void *var, size_t idx, int *val)
+{
+    global_var_load((global_var_s*)var, idx, val);
+}
+
+void aot_store_cb(void *var, size_t idx, int val)
+{
+    global_var_store((global_var_s*)var, idx, val);
+}
+
+void aot_up_cb(void *var, size_t idx)
+{
+    global_var_up((global_var_s*)var, idx);
+}
+
+void aot_down_cb(void *prog, void *var, size_t idx)
+{
+    global_var_down((program_s*)prog, (global_var_s*)var, idx);
+}
+
+/* the C expression of an operand, for the operands that can be used without
+ * the help of the interpreter. Locals that are indexed anywhere in the program
+ * can grow into arrays, and argv needs a constant index for its check to be
+ * a simple guard, so those aren't translated. Array elements whose index was
+ * checked when the image was compiled are */
+int translate_operand(bytecode_image_s *img, const unsigned char *is_array,
+                      const operand_s *op, aot_expr_s *e)
+{
+    const operand_s *idx;
+
+    e->guard[0] = '\0';
+
+    switch (op->kind) {
+        case IMM_OPND:
+            if (op->val == INT_MIN) {
+                snprintf(e->expr, AOT_EXPR_LEN, "(%d - 1)", INT_MIN + 1);
+            } else {
+                snprintf(e->expr, AOT_EXPR_LEN, "(%d)", op->val);
+            }
+            return 1;
+        case LOCAL_OPND:
+            if (is_array[op->val]) {
+                return 0;
+            }
+
+            snprintf(e->expr, AOT_EXPR_LEN, "L[%d].val", op->val);
+            return 1;
+        case LOCAL_ELEM_OPND:
+            idx = &img->opnds[op->idx];
+
+            if (idx->val) {
+                snprintf(e->expr, AOT_EXPR_LEN, "L[%d].arr.pages[%d][%d]", op->val,
+                         idx->val >> INT_ARRAY_PAGE_SHIFT, idx->val & (int)INT_ARRAY_PAGE_MASK);
+            } else {
+                snprintf(e->expr, AOT_EXPR_LEN, "L[%d].val", op->val);
+            }
+            return 1;
+        case ARGC_OPND:
+            snprintf(e->expr, AOT_EXPR_LEN, "A[1]");
+            return 1;
+        case ARGV_OPND:
+            idx = &img->opnds[op->idx];
+
+            if (idx->kind != IMM_OPND || idx->val < 0 || idx->val > INT_MAX - 2) {
+                return 0;
+            }
+
+            snprintf(e->expr, AOT_EXPR_LEN, "A[%d]", idx->val + 2);
+            snprintf(e->guard, AOT_GUARD_LEN, "%d < A[1]", idx->val);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* the index expression of a LOAD/STORE/UP/DOWN operand. Indices out of
+ * bounds are left to the interpreter to report */
+int translate_global(bytecode_image_s *img, const unsigned char *is_array,
+                     const operand_s *op, aot_expr_s *e)
+{
+    aot_expr_s idx;
+
+    if (op->kind == GLOBAL_OPND) {
+        snprintf(e->expr, AOT_EXPR_LEN, "0");
+        e->guard[0] = '\0';
+        return 1;
+    }
+
+    if (op->kind != GLOBAL_ARR_OPND || !translate_operand(img, is_array, &img->opnds[op->idx], &idx)) {
+        return 0;
+    }
+
+    snprintf(e->expr, AOT_EXPR_LEN, "(size_t)%.48s", idx.expr);
+    snprintf(e->guard, AOT_GUARD_LEN, "%.48s >= 0 && %.48s < %d", idx.expr, idx.expr, MAX_INT_ARRAY_LEN);
+    add_guard(e, &idx);
+
+    return 1;
+}
+
+void add_guard(aot_expr_s *dst, const aot_expr_s *src)
+{
+    size_t len = strlen(dst->guard);
+
+    if (!src->guard[0]) {
+        return;
+    }
+
+    if (len) {
+        snprintf(dst->guard + len, AOT_GUARD_LEN - len, " && %s", src->guard);
+    } else {
+        snprintf(dst->guard, AOT_GUARD_LEN, "%s", src->guard);
+    }
+}
+
+#define FUSED_GLOBAL_CASE(name, op) case name##_GLOBAL_SYM:
+
+/* writes the C code of the instruction in position pos. Whatever can't be
+ * translated, or fails its guard at run time, is run by the interpreter */
+int translate_instruction(FILE *out, bytecode_image_s *img, const unsigned char *is_array, size_t pos)
+{
+    const bytecode_s *ins = &img->code[pos];
+    const operand_s *args = &img->opnds[ins->args];
+    instruction_id_e code = bytecode_base_code(ins->code);
+    aot_expr_s e[3], guard;
+    const char *op = NULL;
+    int ok = 1;
+
+    guard.guard[0] = e[0].guard[0] = e[1].guard[0] = e[2].guard[0] = '\0';
+
+    fprintf(out, "L%zu:\n    YIELD(%zu);\n", pos, pos);
+
+    //the interpreter runs these sequences in a single step, reading the global
+    //from its cell instead of calling back into global.c for the LOAD and the
+    //STORE. They aren't atomic either way. It also runs the loops it has
+    //kernels for, all at once
+    switch (img->fused[pos].code) {
+        ARITHMETIC_LIST(FUSED_GLOBAL_CASE)
+        case LOOP_SYM:
+            fprintf(out, "    STEP(%zu);\n", pos);
+            return 0;
+        default:
+            break;
+    }
+
+    switch (code) {
+        case SET_SYM:
+        case ADD_SYM: case SUB_SYM: case MUL_SYM: case DIV_SYM: case MOD_SYM:
+            ok = (args[0].kind == LOCAL_OPND || args[0].kind == LOCAL_ELEM_OPND);
+            //fall through
+        case BRGT_SYM: case BRGE_SYM: case BRLT_SYM: case BRLE_SYM: case BREQ_SYM:
+            for (unsigned int i = 0; i < ins->argc && i < 3; i++) {
+                if (args[i].kind != LABEL_OPND) {
+                    ok = ok && translate_operand(img, is_array, &args[i], &e[i]);
+                    add_guard(&guard, &e[i]);
+                }
+            }
+            break;
+        case LOAD_SYM:
+            ok = (args[0].kind == LOCAL_OPND || args[0].kind == LOCAL_ELEM_OPND) && translate_operand(img, is_array, &args[0], &e[0]) &&
+                 translate_global(img, is_array, &args[1], &e[1]);
+            add_guard(&guard, &e[1]);
+            break;
+        case STORE_SYM:
+            ok = translate_global(img, is_array, &args[0], &e[0]) &&
+                 translate_operand(img, is_array, &args[1], &e[1]);
+            add_guard(&guard, &e[0]);
+            add_guard(&guard, &e[1]);
+            break;
+        case UP_SYM:
+        case DOWN_SYM:
+            ok = translate_global(img, is_array, &args[0], &e[0]);
+            add_guard(&guard, &e[0]);
+            break;
+        case BRA_SYM:
+            break;
+        default:
+            ok = 0;
+            break;
+    }
+
+    if (!ok) {
+        fprintf(out, "    STEP(%zu);\n", pos);
+        return 0;
+    }
+
+    if (guard.guard[0]) {
+        fprintf(out, "    if (!(%s)) STEP(%zu);\n", guard.guard, pos);
+    }
+
+    switch (code) {
+        case SET_SYM:
+            fprintf(out, "    %s = %s;\n", e[0].expr, e[1].expr);
+            break;
+        case ADD_SYM: op = "+"; break;
+        case SUB_SYM: op = "-"; break;
+        case MUL_SYM: op = "*"; break;
+        case DIV_SYM: op = "/"; break;
+        case MOD_SYM: op = "%"; break;
+        case BRGT_SYM: op = ">"; break;
+        case BRGE_SYM: op = ">="; break;
+        case BRLT_SYM: op = "<"; break;
+        case BRLE_SYM: op = "<="; break;
+        case BREQ_SYM: op = "=="; break;
+        case BRA_SYM:
+            fprintf(out, "    goto L%d;\n", args[0].val);
+            break;
+        case LOAD_SYM:
+            fprintf(out, "    env->load(G[%d], %s, &%s);\n", args[1].val, e[1].expr, e[0].expr);
+            break;
+        case STORE_SYM:
+            fprintf(out, "    env->store(G[%d], %s, %s);\n", args[0].val, e[0].expr, e[1].expr);
+            break;
+        case UP_SYM:
+            fprintf(out, "    env->up(G[%d], %s);\n", args[0].val, e[0].expr);
+            break;
+        case DOWN_SYM:
+            //the program may be blocked on the semaphore, which the runtime has to see
+            fprintf(out, "    env->down(env->prog, G[%d], %s);\n"
+                         "    *env->pc = %zu;\n"
+                         "    return n;\n", args[0].val, e[0].expr, pos + 1);
+            break;
+        default:
+            break;
+    }
+
+    if (op && ins->argc == 3 && args[2].kind == LABEL_OPND) {
+        fprintf(out, "    if (%s %s %s) goto L%d;\n", e[0].expr, op, e[1].expr, args[2].val);
+    } else if (op) {
+        fprintf(out, "    %s = %s %s %s;\n", e[0].expr, e[1].expr, op, e[2].expr);
+    }
+
+    return 1;
+}
+
+/* writes the C translation of an image. The generated code can only be
+ * used with the version of the source file it was translated from */
+int write_source(bytecode_image_s *img, const char *file, struct stat *st)
+{
+    unsigned char *is_array;
+    size_t native = 0;
+    FILE *out;
+
+    if (!(out = fopen(file, "w"))) {
+        return 0;
+    }
+
+    is_array = bytecode_array_locals(img);
+
+    fprintf(out,
+            "/* generated by simbly; don't edit */\n"
+            "#include <stddef.h>\n\n"
+            "typedef struct { int **pages; size_t page_cnt, len; int init; void *arena; } int_array_s;\n"
+            "typedef struct { int val; int_array_s arr; } local_var_s;\n\n"
+            "typedef struct {\n"
+            "    void *prog;\n"
+            "    local_var_s *locals;\n"
+            "    const int *argv;\n"
+            "    void **globals;\n"
+            "    size_t *pc;\n"
+            "    int (*step)(void *prog);\n"
+            "    void (*load)(void *var, size_t idx, int *val);\n"
+            "    void (*store)(void *var, size_t idx, int val);\n"
+            "    void (*up)(void *var, size_t idx);\n"
+            "    void (*down)(void *prog, void *var, size_t idx);\n"
+            "} aot_env_s;\n\n"
+            "const unsigned int simbly_abi = %d;\n"
+            "const unsigned long long simbly_src_ino = %lluULL;\n"
+            "const long long simbly_src_mtime_sec = %lldLL;\n"
+            "const long long simbly_src_mtime_nsec = %lldLL;\n\n"
+            "#define YIELD(i) do { if (n >= max_cnt) { *env->pc = (i); return n; } n++; } while (0)\n"
+            "#define STEP(i) do { *env->pc = (i); if (!env->step(env->prog)) return n; goto dispatch; } while (0)\n\n"
+            "size_t simbly_run(aot_env_s *env, size_t max_cnt)\n"
+            "{\n"
+            "    local_var_s *L = env->locals;\n"
+            "    const int *A = env->argv;\n"
+            "    void **G = env->globals;\n"
+            "    size_t n = 0;\n\n"
+            "    (void)L; (void)A; (void)G;\n\n"
+            "dispatch:\n"
+            "    switch (*env->pc) {\n",
+            AOT_ABI_VERSION, (unsigned long long)st->st_ino,
+            (long long)st->st_mtim.tv_sec, (long long)st->st_mtim.tv_nsec);
+
+    for (size_t i = 0; i < img->len; i++) {
+        fprintf(out, "        case %zu: goto L%zu;\n", i, i);
+    }
+
+    fprintf(out, "        default: return n;\n    }\n\n");
+
+    for (size_t i = 0; i < img->len; i++) {
+        native += (size_t)translate_instruction(out, img, is_array, i);
+    }
+
+    //labels of instructions that were optimized away at the end of the image point past it
+    fprintf(out, "L%zu:\n    *env->pc = %zu;\n    return n;\n}\n", img->len, img->len);
+
+    free(is_array);
+
+    if (fclose(out) == EOF) {
+        return 0;
+    }
+
+    shell_msg("translated %zu of %zu instructions to C", native, img->len);
+
+    return 1;
+}
+
+/* builds the shared object with the system C compiler. It's written to a
+ * temporary file first, so that nobody loads a half written object */
+int build_object(const char *src, const char *obj)
+{
+    const char *cc = getenv("CC");
+    char *tmp;
+    size_t tmp_len;
+    pid_t pid;
+    int status;
+
+    if (!cc || !*cc) {
+        cc = AOT_DEFAULT_CC;
+    }
+
+    tmp_len = strlen(obj) + 32;
+    ENO(tmp = malloc(tmp_len));
+    snprintf(tmp, tmp_len, "%s.%ld.tmp", obj, (long)getpid());
+
+    ERR(pid = fork(), pid == -1);
+
+    if (!pid) {
+        execlp(cc, cc, "-O2", "-fwrapv", "-shared", "-fPIC", "-o", tmp, src, (char*)NULL);
+        _exit(127);
+    }
+
+    ERR(pid_t wait_ret = waitpid(pid, &status, 0), wait_ret == -1);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) || rename(tmp, obj)) {
+        unlink(tmp);
+        free(tmp);
+        return 0;
+    }
+
+    free(tmp);
+
+    return 1;
+}
+
+/* translates a source file to C and builds it to a shared object, that
+ * the programs which run the same version of the file will use from then on */
+int aot_compile(const char *fname)
+{
+    program_s *prog;
+    bytecode_image_s *img;
+    struct stat st;
+    char *path, *src = NULL, *obj = NULL;
+    int ret = 0;
+
+    if (!(path = realpath(fname, NULL)) || stat(path, &st) == -1) {
+        shell_msg("file \"%s\" doesn't exist", fname);
+        free(path);
+        return 0;
+    }
+
+    prog = program_init((char*)fname, 0, NULL, PROGRAM_OPT_COMPILE_ONLY);
+    img = (bytecode_image_s*)prog->image;
+
+    if (img) {
+        src = bytecode_file_path(path, &st, AOT_SOURCE_EXT);
+        obj = bytecode_file_path(path, &st, AOT_OBJECT_EXT);
+
+        if (!write_source(img, src, &st)) {
+            shell_msg("couldn't write \"%s\"", src);
+        } else if (!build_object(src, obj)) {
+            shell_msg("couldn't build \"%s\"", obj);
+        } else {
+            shell_msg("compiled \"%s\" to \"%s\"", fname, obj);
+            ret = 1;
+        }
+    } else {
+        shell_msg("\"%s\" has errors; it wasn't compiled", fname);
+    }
+
+    program_free(prog);
+    free(path);
+    free(src);
+    free(obj);
+
+    return ret;
+}
+
+/* opens the shared object of the source file of a program, if it was built
+ * from the current version of the file by a compatible build of simbly */
+aot_s *aot_load(program_s *prog)
+{
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
+    const unsigned int *abi;
+    const unsigned long long *ino;
+    const long long *mtime_sec, *mtime_nsec;
+    struct stat st;
+    char *path, *obj;
+    void *handle;
+    aot_s *aot;
+
+    if (!(path = realpath(prog->fname, NULL)) || stat(path, &st) == -1) {
+        free(path);
+        return NULL;
+    }
+
+    obj = bytecode_file_path(path, &st, AOT_OBJECT_EXT);
+    free(path);
+
+    if (access(obj, R_OK) == -1 || !(handle = dlopen(obj, RTLD_NOW | RTLD_LOCAL))) {
+        free(obj);
+        return NULL;
+    }
+
+    abi = (const unsigned int*)dlsym(handle, "simbly_abi");
+    ino = (const unsigned long long*)dlsym(handle, "simbly_src_ino");
+    mtime_sec = (const long long*)dlsym(handle, "simbly_src_mtime_sec");
+    mtime_nsec = (const long long*)dlsym(handle, "simbly_src_mtime_nsec");
+
+    if (!abi || !ino || !mtime_sec || !mtime_nsec || *abi != AOT_ABI_VERSION ||
+        *ino != (unsigned long long)img->ino ||
+        *mtime_sec != (long long)img->mtime.tv_sec || *mtime_nsec != (long long)img->mtime.tv_nsec) {
+
+        dbg_msg(prog, "shared object %s is out of date", obj);
+        dlclose(handle);
+        free(obj);
+        return NULL;
+    }
+
+    ENO(aot = malloc(sizeof(aot_s)));
+
+    aot->handle = handle;
+    //converting from void* to a function pointer is how dlsym is used on POSIX
+    *(void**)&aot->run = dlsym(handle, "simbly_run");
+
+    if (!aot->run) {
+        dlclose(handle);
+        free(aot);
+        free(obj);
+        return NULL;
+    }
+
+    aot->env.prog = (void*)prog;
+    aot->env.locals = prog->locals;
+    aot->env.argv = prog->argv;
+    aot->env.globals = (void**)img->global_vars;
+    aot->env.pc = &prog->pc;
+    aot->env.step = aot_step_cb;
+    aot->env.load = aot_load_cb;
+    aot->env.store = aot_store_cb;
+    aot->env.up = aot_up_cb;
+    aot->env.down = aot_down_cb;
+
+    dbg_msg(prog, "running native code from %s", obj);
+    free(obj);
+
+    return aot;
+}
+
+void aot_free(aot_s *aot)
+{
+    if (aot) {
+        dlclose(aot->handle);
+        free(aot);
+    }
+}
+
+size_t aot_next_lines(program_s *prog, size_t max_cnt)
+{
+    aot_s *aot = (aot_s*)prog->aot;
+    size_t cnt;
+
+    if (prog->state != INSTRUCTION_LINE) {
+        return 0;
+    }
+
+    cnt = aot->run(&aot->env, max_cnt);
+
+    if (prog->state == INSTRUCTION_LINE && prog->pc >= ((bytecode_image_s*)prog->image)->len) {
+        prog->state = FINISHED;
+    }
+
+    return cnt;
+}
@@ -0,0 +1,54 @@
+#ifndef SIMBLY_AOT_H__
+#define SIMBLY_AOT_H__
+
+#include "common.h"
+#include "program.h"
+#include "bytecode.h"
+
+
+/* a source file is translated to C in a file with this extension, which
+ * is built to a shared object with the other one. Both are saved next to
+ * the image file of the source */
+#define AOT_SOURCE_EXT ".aot.c"
+#define AOT_OBJECT_EXT ".aot.so"
+//the C compiler to build with, if CC isn't set
+#define AOT_DEFAULT_CC "cc"
+
+//has to change every time aot_env_s or the symbols of the shared object change
+#define AOT_ABI_VERSION 3
+
+/* what the code of a shared object gets from the runtime. The generated
+ * source declares the same struct, so both have to agree on its layout */
+typedef struct _aot_env_s {
+    void *prog;
+    local_var_s *locals;
+    const int *argv;
+    void **globals; //the global variable of every global symbol of the image
+    size_t *pc;
+    //runs the instruction at pc in the interpreter. Returns 0 if the program can't go on
+    int (*step)(void *prog);
+    void (*load)(void *var, size_t idx, int *val);
+    void (*store)(void *var, size_t idx, int val);
+    void (*up)(void *var, size_t idx);
+    void (*down)(void *prog, void *var, size_t idx);
+} aot_env_s;
+
+/* runs up to max_cnt instructions, starting from *env->pc, and returns the
+ * number of instructions it ran. It returns earlier if the program blocks,
+ * sleeps, finishes or stops, always with *env->pc pointing to the next
+ * instruction to run, so that the runtime can switch to another program */
+typedef size_t (*aot_run_fn)(aot_env_s *env, size_t max_cnt);
+
+typedef struct _aot_s {
+    void *handle;
+    aot_run_fn run;
+    aot_env_s env;
+} aot_s;
+
+
+int aot_compile(const char *fname);
+aot_s *aot_load(program_s *prog);
+void aot_free(aot_s *aot);
+size_t aot_next_lines(program_s *prog, size_t max_cnt);
+
+#endif //SIMBLY_AOT_H__
@@ -0,0 +1,140 @@
+#include "arena.h"
+#include "error.h"
+
+
+#define ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+//the data of a chunk starts after its header
+#define CHUNK_DATA(chunk) ((char*)(chunk) + ALIGN_UP(sizeof(arena_chunk_s)))
+
+
+static arena_chunk_s *new_chunk(size_t size);
+
+
+
+arena_chunk_s *new_chunk(size_t size)
+{
+    arena_chunk_s *chunk;
+
+    ENO(chunk = malloc(ALIGN_UP(sizeof(arena_chunk_s)) + size));
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+void arena_init(arena_s *arena)
+{
+    arena->chunks = NULL;
+
+    for (size_t i = 0; i < ARENA_CLASS_CNT; i++) {
+        arena->free_lists[i] = NULL;
+    }
+}
+
+void arena_destroy(arena_s *arena)
+{
+    arena_chunk_s *curr = arena->chunks, *next;
+
+    while (curr) {
+        next = curr->next;
+        free(curr);
+        curr = next;
+    }
+
+    arena_init(arena);
+}
+
+/* releases every block, but keeps the first chunk around for the blocks to come */
+void arena_reset(arena_s *arena)
+{
+    arena_chunk_s *first = arena->chunks;
+
+    if (first) {
+        arena->chunks = first->next;
+        arena_destroy(arena);
+
+        if (first->size == ARENA_CHUNK_SIZE) {
+            first->next = NULL;
+            first->used = 0;
+            arena->chunks = first;
+        } else {
+            free(first);
+        }
+    }
+}
+
+void *arena_alloc(arena_s *arena, size_t size)
+{
+    arena_chunk_s *chunk = arena->chunks;
+    void *p;
+
+    size = ALIGN_UP(size ? size : 1);
+
+    if (size <= ARENA_CLASS_CNT * ARENA_ALIGN && arena->free_lists[size / ARENA_ALIGN - 1]) {
+        p = arena->free_lists[size / ARENA_ALIGN - 1];
+        arena->free_lists[size / ARENA_ALIGN - 1] = *(void**)p;
+        return p;
+    }
+
+    //big blocks get a chunk of their own, behind the one that's being used
+    if (size > ARENA_CHUNK_SIZE / 4) {
+        arena_chunk_s *big = new_chunk(size);
+
+        big->used = size;
+
+        if (chunk) {
+            big->next = chunk->next;
+            chunk->next = big;
+        } else {
+            arena->chunks = big;
+        }
+
+        return CHUNK_DATA(big);
+    }
+
+    if (!chunk || chunk->size - chunk->used < size) {
+        chunk = new_chunk(ARENA_CHUNK_SIZE);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    p = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += size;
+
+    return p;
+}
+
+void *arena_realloc(arena_s *arena, void *p, size_t old_size, size_t new_size)
+{
+    void *new_p = arena_alloc(arena, new_size);
+
+    if (p) {
+        memcpy(new_p, p, (old_size < new_size) ? old_size : new_size);
+        arena_free(arena, p, old_size);
+    }
+
+    return new_p;
+}
+
+/* small blocks are kept to be reused by arena_alloc(). The memory of
+ * the rest is only released with the whole arena */
+void arena_free(arena_s *arena, void *p, size_t size)
+{
+    size = ALIGN_UP(size ? size : 1);
+
+    if (p && size <= ARENA_CLASS_CNT * ARENA_ALIGN) {
+        *(void**)p = arena->free_lists[size / ARENA_ALIGN - 1];
+        arena->free_lists[size / ARENA_ALIGN - 1] = p;
+    }
+}
+
+char *arena_strdup(arena_s *arena, const char *str, size_t len)
+{
+    char *dup = (char*)arena_alloc(arena, len);
+
+    memcpy(dup, str, len);
+
+    return dup;
+}
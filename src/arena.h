@@ -0,0 +1,34 @@
+#ifndef SIMBLY_ARENA_H__
+#define SIMBLY_ARENA_H__
+
+#include "common.h"
+
+
+#define ARENA_CHUNK_SIZE 16384
+//every block is aligned to this
+#define ARENA_ALIGN 16
+//freed blocks of up to ARENA_CLASS_CNT * ARENA_ALIGN bytes are kept in a list per size, to be reused
+#define ARENA_CLASS_CNT 16
+
+typedef struct _arena_chunk_s {
+    struct _arena_chunk_s *next;
+    size_t size, used;
+} arena_chunk_s;
+
+/* a bump allocator. Blocks are carved out of big chunks and are released
+ * all together, so that a program never has to free its blocks one by one */
+typedef struct _arena_s {
+    arena_chunk_s *chunks; //the chunk that blocks are carved from is the first
+    void *free_lists[ARENA_CLASS_CNT];
+} arena_s;
+
+
+void arena_init(arena_s *arena);
+void arena_destroy(arena_s *arena);
+void arena_reset(arena_s *arena);
+void *arena_alloc(arena_s *arena, size_t size);
+void *arena_realloc(arena_s *arena, void *p, size_t old_size, size_t new_size);
+void arena_free(arena_s *arena, void *p, size_t size);
+char *arena_strdup(arena_s *arena, const char *str, size_t len);
+
+#endif //SIMBLY_ARENA_H__
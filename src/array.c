@@ -0,0 +1,153 @@
+#include "array.h"
+#include "error.h"
+
+
+void int_array_init(int_array_s *arr, int init, arena_s *arena)
+{
+    arr->pages = NULL;
+    arr->page_cnt = 0;
+    arr->len = 0;
+    arr->init = init;
+    arr->arena = arena;
+}
+
+/* the pages of arrays in an arena are released with the arena */
+void int_array_destroy(int_array_s *arr)
+{
+    if (!arr->arena) {
+        for (size_t i = 0; i < arr->page_cnt; i++) {
+            free(arr->pages[i]);
+        }
+
+        free(arr->pages);
+    }
+
+    arr->pages = NULL;
+    arr->page_cnt = arr->len = 0;
+}
+
+/* reads an element without allocating its page */
+int int_array_get(int_array_s *arr, size_t idx)
+{
+    size_t page = idx >> INT_ARRAY_PAGE_SHIFT;
+
+    ASRT(idx < MAX_INT_ARRAY_LEN);
+
+    if (idx >= arr->len) {
+        arr->len = idx + 1;
+    }
+
+    if (page >= arr->page_cnt || !arr->pages[page]) {
+        return arr->init;
+    }
+
+    return arr->pages[page][idx & INT_ARRAY_PAGE_MASK];
+}
+
+/* returns a pointer to an element, allocating its page if it doesn't exist.
+ * The pointer stays valid until the array is destroyed */
+int *int_array_elem(int_array_s *arr, size_t idx)
+{
+    size_t page = idx >> INT_ARRAY_PAGE_SHIFT;
+
+    ASRT(idx < MAX_INT_ARRAY_LEN);
+
+    if (page >= arr->page_cnt) {
+        size_t cnt = arr->page_cnt ? arr->page_cnt : 1;
+
+        while (cnt <= page) {
+            cnt += cnt;
+        }
+
+        if (arr->arena) {
+            arr->pages = (int**)arena_realloc(arr->arena, arr->pages, sizeof(int*) * arr->page_cnt, sizeof(int*) * cnt);
+        } else {
+            ENO(arr->pages = realloc(arr->pages, sizeof(int*) * cnt));
+        }
+
+        for (size_t i = arr->page_cnt; i < cnt; i++) {
+            arr->pages[i] = NULL;
+        }
+
+        arr->page_cnt = cnt;
+    }
+
+    if (!arr->pages[page]) {
+        if (arr->arena) {
+            arr->pages[page] = (int*)arena_alloc(arr->arena, sizeof(int) * INT_ARRAY_PAGE_LEN);
+        } else {
+            ENO(arr->pages[page] = malloc(sizeof(int) * INT_ARRAY_PAGE_LEN));
+        }
+
+        for (size_t i = 0; i < INT_ARRAY_PAGE_LEN; i++) {
+            arr->pages[page][i] = arr->init;
+        }
+    }
+
+    if (idx >= arr->len) {
+        arr->len = idx + 1;
+    }
+
+    return &arr->pages[page][idx & INT_ARRAY_PAGE_MASK];
+}
+
+/* returns a pointer to *len contiguous elements starting from idx, allocating
+ * their page if it doesn't exist. Elements are only contiguous inside a page,
+ * so *len is lowered to the number of elements left in the page of idx */
+int *int_array_run(int_array_s *arr, size_t idx, size_t *len)
+{
+    size_t left = INT_ARRAY_PAGE_LEN - (idx & INT_ARRAY_PAGE_MASK);
+
+    ASRT(*len);
+
+    if (*len > left) {
+        *len = left;
+    }
+
+    return int_array_elem(arr, idx + *len - 1) - (*len - 1);
+}
+
+/* like int_array_run, but for reading; pages that were never written aren't
+ * allocated if their elements are 0 */
+const int *int_array_read_run(int_array_s *arr, size_t idx, size_t *len)
+{
+    static const int zero_page[INT_ARRAY_PAGE_LEN];
+    size_t page = idx >> INT_ARRAY_PAGE_SHIFT, left = INT_ARRAY_PAGE_LEN - (idx & INT_ARRAY_PAGE_MASK);
+
+    if (arr->init || (page < arr->page_cnt && arr->pages[page])) {
+        return int_array_run(arr, idx, len);
+    }
+
+    ASRT(*len);
+
+    if (*len > left) {
+        *len = left;
+    }
+
+    ASRT(idx + *len <= MAX_INT_ARRAY_LEN);
+
+    if (idx + *len > arr->len) {
+        arr->len = idx + *len;
+    }
+
+    return zero_page;
+}
+
+/* copies cnt elements of src, starting from src_idx, to the elements of
+ * dst starting from dst_idx. The arrays have to be different */
+void int_array_copy(int_array_s *dst, size_t dst_idx, int_array_s *src, size_t src_idx, size_t cnt)
+{
+    ASRT(dst != src);
+
+    while (cnt) {
+        size_t len = cnt;
+        int *to = int_array_run(dst, dst_idx, &len);
+        const int *from = int_array_read_run(src, src_idx, &len);
+
+        memcpy(to, from, sizeof(int) * len);
+
+        dst_idx += len;
+        src_idx += len;
+        cnt -= len;
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef SIMBLY_ARRAY_H__
+#define SIMBLY_ARRAY_H__
+
+#include "common.h"
+#include "arena.h"
+
+
+/* elements are stored in pages of this many integers, which are only
+ * allocated when one of their elements is written */
+#define INT_ARRAY_PAGE_SHIFT 10
+#define INT_ARRAY_PAGE_LEN ((size_t)1 << INT_ARRAY_PAGE_SHIFT)
+#define INT_ARRAY_PAGE_MASK (INT_ARRAY_PAGE_LEN - 1)
+
+/* an integer array that can be indexed sparsely. The table of pages grows
+ * geometrically, and no element is ever moved once its page is allocated */
+typedef struct _int_array_s {
+    int **pages; //pages that were never written are NULL
+    size_t page_cnt;
+    size_t len; //one more than the biggest index that was used
+    int init; //the value of the elements that were never written
+    arena_s *arena; //where the pages are allocated from, or NULL for the heap
+} int_array_s;
+
+
+void int_array_init(int_array_s *arr, int init, arena_s *arena);
+void int_array_destroy(int_array_s *arr);
+int int_array_get(int_array_s *arr, size_t idx);
+int *int_array_elem(int_array_s *arr, size_t idx);
+int *int_array_run(int_array_s *arr, size_t idx, size_t *len);
+const int *int_array_read_run(int_array_s *arr, size_t idx, size_t *len);
+void int_array_copy(int_array_s *dst, size_t dst_idx, int_array_s *src, size_t src_idx, size_t cnt);
+
+#endif //SIMBLY_ARRAY_H__
@@ -0,0 +1,1173 @@
+#include "bytecode.h"
+#include "optimize.h"
+#include "loop.h"
+#include "error.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+/* the tokens of a source line, as the scanner produced them. These only
+ * live until the operands of the line are translated */
+typedef struct _source_line_s {
+    token_s *label, **args;
+    size_t argc;
+} source_line_s;
+
+typedef struct _compile_ctx_s {
+    program_s *prog;
+    bytecode_image_s *img;
+    source_line_s *lines;
+    QuadHashtable *labels, *symbols, *global_symbols;
+} compile_ctx_s;
+
+/* offsets of the arrays of an image inside an image file */
+typedef struct _file_layout_s {
+    size_t locals, globals, code, opnds, strs, total;
+} file_layout_s;
+
+#define ALIGN_8(x) (((x) + 7) & ~(size_t)7)
+
+/* what the executor can assume about an operand when picking a specialized variant */
+typedef enum _operand_shape_e {
+    ANY_SHAPE,
+    REG_SHAPE,  //a local variable that's never used as an array
+    IMM_SHAPE   //an integer value
+} operand_shape_e;
+
+
+static QuadHashtable *image_cache;
+static pthread_mutex_t image_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int image_cache_initialized = 0;
+
+//makes the names of the temporary image files unique, since the same file can be compiled by two programs at once
+static unsigned long image_tmp_cnt = 0;
+
+
+static int translate_line(compile_ctx_s *ctx);
+static int resolve_labels(compile_ctx_s *ctx);
+static int translate_operands(compile_ctx_s *ctx);
+static void specialize_instructions(bytecode_image_s *img);
+static void fuse_instructions(bytecode_image_s *img);
+static int operands_adjacent(bytecode_image_s *img, size_t pos, size_t cnt);
+static instruction_id_e increment_branch_code(instruction_id_e branch);
+static int translate_operand(compile_ctx_s *ctx, size_t pos, token_type_e type,
+                             varval_u *data, size_t len, int is_global);
+static char *token_name(char *buf, const void *name, size_t len);
+static int local_slot(compile_ctx_s *ctx, char *name, int *slot);
+static int global_symbol(compile_ctx_s *ctx, char *name);
+static size_t new_operand(compile_ctx_s *ctx);
+static size_t add_string(compile_ctx_s *ctx, const char *str, size_t len);
+static int is_global_arg(instruction_id_e code, size_t arg);
+static int is_dest_arg(instruction_id_e code, size_t arg);
+static int is_array_arg(instruction_id_e code, size_t arg);
+static void free_cached_image_cb(void *p);
+static void image_unref(bytecode_image_s *img);
+static int image_is_stale(bytecode_image_s *img, struct stat *st);
+static void image_file_layout(const bytecode_file_hdr_s *hdr, file_layout_s *layout);
+static bytecode_image_s *image_file_load(program_s *prog, const char *file, struct stat *st);
+static void image_file_write(program_s *prog, bytecode_image_s *img, const char *file, struct stat *st);
+
+
+
+void free_cached_image_cb(void *p)
+{
+    KeyValuePair item = *(KeyValuePair*)p;
+
+    free(item.pKey);
+    image_unref((bytecode_image_s*)item.pData);
+}
+
+/* drops a reference to an image; has to be called with image_cache_lock held */
+void image_unref(bytecode_image_s *img)
+{
+    if (img && !--img->refcnt) {
+        bytecode_free(img);
+    }
+}
+
+int image_is_stale(bytecode_image_s *img, struct stat *st)
+{
+    return img->dev != st->st_dev || img->ino != st->st_ino ||
+           img->mtime.tv_sec != st->st_mtim.tv_sec ||
+           img->mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+/* moves all the tokens that tokenize_next_line() left in the translated_line
+ * buffer into the next instruction of the image. Returns 0 if there were
+ * no tokens to read */
+int translate_line(compile_ctx_s *ctx)
+{
+    vdsErrCode verr;
+    bytecode_image_s *img = ctx->img;
+    source_line_s *line;
+    bytecode_s *ins;
+    token_s *tok;
+    size_t args_size;
+
+    tok = (token_s*)RingBuffer_read(ctx->prog->translated_line, &verr);
+
+    if (!tok) {
+        return 0;
+    }
+
+    if (img->len >= img->size) {
+        img->size += img->size;
+        ENO(img->code = realloc(img->code, sizeof(bytecode_s) * img->size));
+        ENO(ctx->lines = realloc(ctx->lines, sizeof(source_line_s) * img->size));
+    }
+
+    line = &ctx->lines[img->len];
+    ins = &img->code[img->len++];
+
+    line->label = NULL;
+    line->args = NULL;
+    line->argc = 0;
+
+    if (tok->type == LABEL_TOK) {
+        line->label = tok;
+        tok = (token_s*)RingBuffer_read(ctx->prog->translated_line, &verr);
+    }
+
+    ASRT(tok && tok->type == INSTRUCTION_TOK);
+
+    ins->code = (instruction_id_e)tok->data.value;
+    ins->line = tok->line;
+    ins->column = tok->column;
+    ins->prev_col = tok->prev_col;
+
+    free_token(ctx->prog, tok);
+
+    args_size = DEFAULT_TRANSLATED_LINE_LEN;
+    line->args = (token_s**)arena_alloc(&ctx->prog->scratch, sizeof(token_s*) * args_size);
+
+    while ( (tok = (token_s*)RingBuffer_read(ctx->prog->translated_line, &verr)) ) {
+
+        if (line->argc >= args_size) {
+            line->args = (token_s**)arena_realloc(&ctx->prog->scratch, line->args, sizeof(token_s*) * args_size,
+                                                  sizeof(token_s*) * args_size * 2);
+            args_size += args_size;
+        }
+
+        line->args[line->argc++] = tok;
+    }
+
+    return 1;
+}
+
+/* whether the operand in position arg of an instruction is a global variable */
+int is_global_arg(instruction_id_e code, size_t arg)
+{
+    switch (code) {
+        case LOAD_SYM:
+        case LOADN_SYM:
+        case FADD_SYM:
+        case SWAP_SYM:
+        case CAS_SYM:
+            return arg == 1;
+        case STORE_SYM:
+        case STOREN_SYM:
+        case DOWN_SYM:
+        case UP_SYM:
+            return arg == 0;
+        default:
+            return 0;
+    }
+}
+
+/* whether the operand in position arg of an instruction is written to */
+int is_dest_arg(instruction_id_e code, size_t arg)
+{
+    switch (code) {
+        case LOAD_SYM:
+        case SET_SYM:
+        case ADD_SYM:
+        case SUB_SYM:
+        case MUL_SYM:
+        case DIV_SYM:
+        case MOD_SYM:
+        case VADD_SYM:
+        case VSUB_SYM:
+        case VMUL_SYM:
+        case VFILL_SYM:
+        case VCOPY_SYM:
+        case VSUM_SYM:
+        case VMIN_SYM:
+        case VMAX_SYM:
+        case LOADN_SYM:
+        case FADD_SYM:
+        case SWAP_SYM:
+        case CAS_SYM:
+            return arg == 0;
+        default:
+            return 0;
+    }
+}
+
+/* whether the operand in position arg of a vector instruction has to be
+ * the first element of a range of a local array */
+int is_array_arg(instruction_id_e code, size_t arg)
+{
+    switch (code) {
+        case VADD_SYM:
+        case VSUB_SYM:
+        case VMUL_SYM:
+        case VCOPY_SYM:
+            return arg < 2;
+        case VFILL_SYM:
+        case LOADN_SYM:
+            return arg == 0;
+        case VSUM_SYM:
+        case VMIN_SYM:
+        case VMAX_SYM:
+        case STOREN_SYM:
+            return arg == 1;
+        default:
+            return 0;
+    }
+}
+
+size_t new_operand(compile_ctx_s *ctx)
+{
+    bytecode_image_s *img = ctx->img;
+
+    if (img->opnd_len >= img->opnd_size) {
+        img->opnd_size += img->opnd_size;
+        ENO(img->opnds = realloc(img->opnds, sizeof(operand_s) * img->opnd_size));
+    }
+
+    return img->opnd_len++;
+}
+
+/* appends the first len characters of str to the string pool, as a C string */
+size_t add_string(compile_ctx_s *ctx, const char *str, size_t len)
+{
+    bytecode_image_s *img = ctx->img;
+    size_t offset = img->strs_len;
+
+    while (img->strs_len + len + 1 > img->strs_size) {
+        img->strs_size += img->strs_size;
+        ENO(img->strs = realloc(img->strs, img->strs_size));
+    }
+
+    memcpy(&img->strs[offset], str, len);
+    img->strs[offset + len] = 0;
+    img->strs_len += len + 1;
+
+    return offset;
+}
+
+/* tokens point to their names in the source file; this copies a name to
+ * buf as a C string, so that it can be used as a key in the symbol tables */
+char *token_name(char *buf, const void *name, size_t len)
+{
+    ASRT(len <= MAX_ALLOWED_SYMBOL_LEN);
+
+    memcpy(buf, name, len);
+    buf[len] = 0;
+
+    return buf;
+}
+
+/* finds the register file slot of a local variable, giving it
+ * a new one if this is the first time the variable is seen */
+int local_slot(compile_ctx_s *ctx, char *name, int *slot)
+{
+    vdsErrCode verr;
+    bytecode_image_s *img = ctx->img;
+    KeyValuePair *pair;
+    size_t key_len = strlen(name) + 1;
+    int *new_slot;
+
+    //local variables and labels share the same namespace
+    VDS(pair = QuadHash_find(ctx->labels, (void*)name, key_len, &verr), verr);
+
+    if (pair) {
+        program_stop(ctx->prog, 1);
+        err_msg(ctx->prog, "there's already a label with the same name defined\n\t%s\n\t^", name);
+        return 0;
+    }
+
+    VDS(pair = QuadHash_find(ctx->symbols, (void*)name, key_len, &verr), verr);
+
+    if (pair) {
+        *slot = *(int*)pair->pData;
+        return 1;
+    }
+
+    if (img->local_cnt >= img->locals_size) {
+        img->locals_size += img->locals_size;
+        ENO(img->locals = realloc(img->locals, sizeof(size_t) * img->locals_size));
+    }
+
+    new_slot = (int*)arena_alloc(&ctx->prog->scratch, sizeof(int));
+    *new_slot = (int)img->local_cnt;
+
+    img->locals[img->local_cnt++] = add_string(ctx, name, key_len - 1);
+
+    VDS(QuadHash_insert(ctx->symbols, (void*)new_slot, (void*)arena_strdup(&ctx->prog->scratch, name, key_len),
+                        key_len, NULL, &verr), verr);
+
+    *slot = *new_slot;
+    return 1;
+}
+
+/* interns the name of a global variable in the symbol table of the image */
+int global_symbol(compile_ctx_s *ctx, char *name)
+{
+    vdsErrCode verr;
+    bytecode_image_s *img = ctx->img;
+    KeyValuePair *pair;
+    size_t key_len = strlen(name) + 1;
+    int *new_sym;
+
+    VDS(pair = QuadHash_find(ctx->global_symbols, (void*)name, key_len, &verr), verr);
+
+    if (pair) {
+        return *(int*)pair->pData;
+    }
+
+    if (img->global_cnt >= img->globals_size) {
+        img->globals_size += img->globals_size;
+        ENO(img->globals = realloc(img->globals, sizeof(size_t) * img->globals_size));
+    }
+
+    new_sym = (int*)arena_alloc(&ctx->prog->scratch, sizeof(int));
+    *new_sym = (int)img->global_cnt;
+
+    img->globals[img->global_cnt++] = add_string(ctx, name, key_len - 1);
+
+    VDS(QuadHash_insert(ctx->global_symbols, (void*)new_sym, (void*)arena_strdup(&ctx->prog->scratch, name, key_len),
+                        key_len, NULL, &verr), verr);
+
+    return *new_sym;
+}
+
+/* converts the data of an operand token to the operand in position pos of the
+ * operand pool. Array indices are appended to the pool recursively */
+int translate_operand(compile_ctx_s *ctx, size_t pos, token_type_e type,
+                      varval_u *data, size_t len, int is_global)
+{
+    vdsErrCode verr;
+    KeyValuePair *pair;
+    operand_s op;
+    char name[MAX_ALLOWED_SYMBOL_LEN + 1];
+
+    op.kind = IMM_OPND;
+    op.val = 0;
+    op.idx = -1;
+
+    switch (type) {
+        case INT_VAL_TOK:
+            op.val = data->value;
+            break;
+        case STRING_TOK:
+            op.kind = STRING_OPND;
+            op.val = (int)add_string(ctx, (char*)data->ptr, len);
+            break;
+        case LABEL_TOK:
+            token_name(name, data->ptr, len);
+
+            VDS(pair = QuadHash_find(ctx->labels, (void*)name, strlen(name) + 1, &verr), verr);
+
+            if (!pair) {
+                program_stop(ctx->prog, 1);
+                err_msg(ctx->prog, "couldn't jump to undefined label\n\t%s\n\t^", name);
+                return 0;
+            }
+
+            op.kind = LABEL_OPND;
+            op.val = (int)*(size_t*)pair->pData;
+            break;
+        case INT_VAR_TOK:
+            token_name(name, data->ptr, len);
+
+            if (is_global) {
+                op.kind = GLOBAL_OPND;
+                op.val = global_symbol(ctx, name);
+            } else if (!strcmp("argc", name)) {
+                op.kind = ARGC_OPND;
+            } else {
+                op.kind = LOCAL_OPND;
+                if (!local_slot(ctx, name, &op.val))
+                    return 0;
+            }
+            break;
+        case INT_ARR_TOK:
+        {
+            int_arr_tok_s *arr = (int_arr_tok_s*)data->ptr;
+
+            op.idx = (int)new_operand(ctx);
+
+            if (!translate_operand(ctx, (size_t)op.idx, arr->idx_type, &arr->idx, arr->idx_len, 0)) {
+                return 0;
+            }
+
+            token_name(name, arr->name, arr->name_len);
+
+            if (is_global) {
+                op.kind = GLOBAL_ARR_OPND;
+                op.val = global_symbol(ctx, name);
+            } else if (!strcmp("argv", name)) {
+                op.kind = ARGV_OPND;
+            } else {
+                op.kind = LOCAL_ARR_OPND;
+                if (!local_slot(ctx, name, &op.val))
+                    return 0;
+            }
+            break;
+        }
+        default:
+            return 0;
+    }
+
+    //the pool might have been reallocated by now, so write the operand at the end
+    ctx->img->opnds[pos] = op;
+
+    return 1;
+}
+
+#define ARITHMETIC_VARIANT_CASE(name, op) \
+    case name##_SYM: \
+        if (shape[0] == REG_SHAPE && shape[1] == REG_SHAPE && shape[2] == REG_SHAPE) \
+            ins->code = name##_RRR_SYM; \
+        else if (shape[0] == REG_SHAPE && shape[1] == REG_SHAPE && shape[2] == IMM_SHAPE) \
+            ins->code = name##_RRI_SYM; \
+        else if (shape[0] == REG_SHAPE && shape[1] == IMM_SHAPE && shape[2] == REG_SHAPE) \
+            ins->code = name##_RIR_SYM; \
+        break;
+
+#define BRANCH_VARIANT_CASE(name, op) \
+    case name##_SYM: \
+        if (shape[0] == REG_SHAPE && shape[1] == REG_SHAPE) \
+            ins->code = name##_RR_SYM; \
+        else if (shape[0] == REG_SHAPE && shape[1] == IMM_SHAPE) \
+            ins->code = name##_RI_SYM; \
+        else if (shape[0] == IMM_SHAPE && shape[1] == REG_SHAPE) \
+            ins->code = name##_IR_SYM; \
+        break;
+
+/* the locals that are indexed anywhere in the program. The caller frees the returned array */
+unsigned char *bytecode_array_locals(bytecode_image_s *img)
+{
+    unsigned char *is_array;
+
+    ENO(is_array = calloc(img->local_cnt + 1, sizeof(unsigned char)));
+
+    for (size_t i = 0; i < img->opnd_len; i++) {
+        if (img->opnds[i].kind == LOCAL_ARR_OPND || img->opnds[i].kind == LOCAL_ELEM_OPND) {
+            is_array[img->opnds[i].val] = 1;
+        }
+    }
+
+    return is_array;
+}
+
+/* replaces instructions whose operands are all plain local variables or
+ * integer values with variants that read and write them directly. A local
+ * that's indexed anywhere in the program can turn into an array at run time,
+ * so it always goes through the generic operand path.
+ * Array elements with an integer index are checked here instead of at run
+ * time, if the array is never used by its name; the pages of those elements
+ * are then allocated when the program starts */
+void specialize_instructions(bytecode_image_s *img)
+{
+    operand_shape_e shape[3];
+    unsigned char *is_array, *by_name;
+
+    is_array = bytecode_array_locals(img);
+    ENO(by_name = calloc(img->local_cnt + 1, sizeof(unsigned char)));
+
+    for (size_t i = 0; i < img->opnd_len; i++) {
+        if (img->opnds[i].kind == LOCAL_OPND) {
+            by_name[img->opnds[i].val] = 1;
+        }
+    }
+
+    for (size_t i = 0; i < img->opnd_len; i++) {
+        operand_s *op = &img->opnds[i];
+
+        if (op->kind == LOCAL_ARR_OPND && !by_name[op->val] && img->opnds[op->idx].kind == IMM_OPND &&
+            img->opnds[op->idx].val >= 0 && img->opnds[op->idx].val < MAX_INT_ARRAY_LEN) {
+            op->kind = LOCAL_ELEM_OPND;
+        }
+    }
+
+    for (size_t i = 0; i < img->len; i++) {
+        bytecode_s *ins = &img->code[i];
+        const operand_s *args = &img->opnds[ins->args];
+
+        for (unsigned int j = 0; j < ARRAY_LEN(shape); j++) {
+            shape[j] = ANY_SHAPE;
+
+            if (j < ins->argc) {
+                if (args[j].kind == IMM_OPND) {
+                    shape[j] = IMM_SHAPE;
+                } else if (args[j].kind == LOCAL_OPND && !is_array[args[j].val]) {
+                    shape[j] = REG_SHAPE;
+                }
+            }
+        }
+
+        switch (ins->code) {
+            case SET_SYM:
+                if (shape[0] == REG_SHAPE && shape[1] == REG_SHAPE)
+                    ins->code = SET_RR_SYM;
+                else if (shape[0] == REG_SHAPE && shape[1] == IMM_SHAPE)
+                    ins->code = SET_RI_SYM;
+                break;
+            ARITHMETIC_LIST(ARITHMETIC_VARIANT_CASE)
+            BRANCH_LIST(BRANCH_VARIANT_CASE)
+            default:
+                break;
+        }
+    }
+
+    free(by_name);
+    free(is_array);
+}
+
+#define BASE_ARITHMETIC_CASE(name, op) \
+    case name##_RRR_SYM: \
+    case name##_RRI_SYM: \
+    case name##_RIR_SYM: \
+        return name##_SYM;
+
+#define BASE_BRANCH_CASE(name, op) \
+    case name##_RR_SYM: \
+    case name##_RI_SYM: \
+    case name##_IR_SYM: \
+        return name##_SYM;
+
+/* the instruction that a specialized variant was made from */
+instruction_id_e bytecode_base_code(instruction_id_e code)
+{
+    switch (code) {
+        case SET_RR_SYM:
+        case SET_RI_SYM:
+            return SET_SYM;
+        ARITHMETIC_LIST(BASE_ARITHMETIC_CASE)
+        BRANCH_LIST(BASE_BRANCH_CASE)
+        default:
+            return code;
+    }
+}
+
+/* whether the instructions from pos to pos + cnt - 1 exist and their operands
+ * follow each other in the pool, so that a superinstruction can use them as one list */
+int operands_adjacent(bytecode_image_s *img, size_t pos, size_t cnt)
+{
+    if (pos + cnt > img->len) {
+        return 0;
+    }
+
+    for (size_t i = pos; i < pos + cnt - 1; i++) {
+        if (img->code[i].args + img->code[i].argc != img->code[i + 1].args) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#define FUSED_ARITHMETIC_CASE(name, op) \
+    case name##_RRI_SYM: \
+        if (!operands_adjacent(img, i, 2)) \
+            break; \
+        if (next->code == BRA_SYM) \
+            ins->code = name##_RRI_BRA_SYM; \
+        else if (ins->code == ADD_RRI_SYM) \
+            ins->code = increment_branch_code(next->code); \
+        break;
+
+#define FUSED_GLOBAL_CASE(name, op) \
+    case name##_RRR_SYM: \
+    case name##_RRI_SYM: \
+        global_code = name##_GLOBAL_SYM; \
+        break;
+
+#define FUSED_BRANCH_CASE(name, op) \
+    case name##_RR_SYM: \
+        return INC_##name##_RR_SYM; \
+    case name##_RI_SYM: \
+        return INC_##name##_RI_SYM;
+
+/* the superinstruction of an ADD_RRI followed by a branch */
+instruction_id_e increment_branch_code(instruction_id_e branch)
+{
+    switch (branch) {
+        BRANCH_LIST(FUSED_BRANCH_CASE)
+        default:
+            return ADD_RRI_SYM;
+    }
+}
+
+/* builds the copy of the code that programs run when fusion is enabled, with
+ * the first instruction of every sequence that has a superinstruction replaced
+ * by it. The rest of the sequence is left in place, for jumps that land in it */
+void fuse_instructions(bytecode_image_s *img)
+{
+    ENO(img->fused = malloc(sizeof(bytecode_s) * (img->len + 1)));
+    memcpy(img->fused, img->code, sizeof(bytecode_s) * img->len);
+
+    for (size_t i = 0; i < img->len; i++) {
+        bytecode_s *ins = &img->fused[i];
+        const bytecode_s *next = &img->code[i + 1];
+        const operand_s *args = &img->opnds[ins->args];
+        instruction_id_e global_code = INSTRUCTION_CNT;
+
+        switch (ins->code) {
+            ARITHMETIC_LIST(FUSED_ARITHMETIC_CASE)
+            case LOAD_SYM:
+                //LOAD $k $g, OP $k $k x, STORE $g $k
+                if (!operands_adjacent(img, i, 3)) {
+                    break;
+                }
+
+                switch (next->code) {
+                    ARITHMETIC_LIST(FUSED_GLOBAL_CASE)
+                    default:
+                        break;
+                }
+
+                //the operands of the sequence are only read once its shape is
+                //known, since the operand pool can end right after the LOAD
+                if (global_code == INSTRUCTION_CNT || next->argc != 3 ||
+                    img->code[i + 2].code != STORE_SYM || img->code[i + 2].argc != 2 ||
+                    args[0].kind != LOCAL_OPND || args[1].kind != GLOBAL_OPND ||
+                    args[5].kind != GLOBAL_OPND || args[5].val != args[1].val ||
+                    args[6].kind != LOCAL_OPND || args[6].val != args[0].val) {
+                    break;
+                }
+
+                //the specialized variants guarantee that args 2 and 3 are locals
+                if (args[2].val == args[0].val && args[3].val == args[0].val) {
+                    ins->code = global_code;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* builds the table with the location of every label in the program */
+int resolve_labels(compile_ctx_s *ctx)
+{
+    vdsErrCode verr;
+    token_s *tok;
+    size_t *idx;
+    char name[MAX_ALLOWED_SYMBOL_LEN + 1], *key;
+
+    for (size_t i = 0; i < ctx->img->len; i++) {
+
+        tok = ctx->lines[i].label;
+
+        if (tok) {
+            idx = (size_t*)arena_alloc(&ctx->prog->scratch, sizeof(size_t));
+            *idx = i;
+
+            key = arena_strdup(&ctx->prog->scratch, token_name(name, tok->data.ptr, tok->len), tok->len + 1);
+
+            QuadHash_insert(ctx->labels, (void*)idx, (void*)key, tok->len + 1, NULL, &verr);
+
+            if (verr != VDS_SUCCESS) {
+                program_stop(ctx->prog, 1);
+                SET_PARSER_IDX(ctx->prog, tok);
+                err_msg(ctx->prog, "can't redefine label with the same name!\n\t%s\n\t^", name);
+                RESET_PARSER_IDX(ctx->prog);
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* replaces the operand tokens of every instruction with their decoded
+ * operands, with the variable names resolved to register file slots */
+int translate_operands(compile_ctx_s *ctx)
+{
+    program_s *prog = ctx->prog;
+    bytecode_image_s *img = ctx->img;
+    operand_kind_e kind;
+    token_s *tok;
+    int ret;
+
+    for (size_t i = 0; i < img->len; i++) {
+        source_line_s *line = &ctx->lines[i];
+        bytecode_s *ins = &img->code[i];
+
+        ins->argc = (unsigned int)line->argc;
+        ins->args = (unsigned int)img->opnd_len;
+
+        //reserve a contiguous space for the operands of the instruction
+        for (size_t j = 0; j < line->argc; j++) {
+            (void)new_operand(ctx);
+        }
+
+        for (size_t j = 0; j < line->argc; j++) {
+
+            tok = line->args[j];
+
+            SET_PARSER_IDX(prog, tok);
+
+            ret = translate_operand(ctx, ins->args + j, tok->type, &tok->data, tok->len,
+                                    is_global_arg(ins->code, j));
+
+            if (ret && is_dest_arg(ins->code, j)) {
+                kind = img->opnds[ins->args + j].kind;
+
+                if (kind == ARGC_OPND || kind == ARGV_OPND) {
+                    program_stop(prog, 1);
+                    err_msg(prog, "the value of %s is constant; setting it to another value isn't allowed",
+                            (kind == ARGC_OPND) ? "argc" : "argv");
+                    ret = 0;
+                }
+            }
+
+            if (ret && is_array_arg(ins->code, j) && img->opnds[ins->args + j].kind != LOCAL_ARR_OPND) {
+                program_stop(prog, 1);
+                err_msg(prog, "%s instruction expects an element of a local array as its argument %zu",
+                        lexer_instruction_name(ins->code), j + 1);
+                ret = 0;
+            }
+
+            RESET_PARSER_IDX(prog);
+
+            if (!ret) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* looks up (or creates) the global variable of every global symbol of the
+ * image, so that executing the program never has to search the global table */
+void bytecode_bind_globals(bytecode_image_s *img)
+{
+    ENO(img->global_vars = malloc(sizeof(global_var_s*) * (img->global_cnt + 1)));
+
+    for (size_t i = 0; i < img->global_cnt; i++) {
+        const char *name = &img->strs[img->globals[i]];
+
+        img->global_vars[i] = global_var_bind(name, strlen(name) + 1);
+    }
+}
+
+/* tokenizes the whole source file of the program, once, and returns the
+ * array of decoded instructions that the executor runs. On a syntax error
+ * the program is stopped and NULL is returned */
+bytecode_image_s *bytecode_compile(program_s *prog)
+{
+    vdsErrCode verr;
+    bytecode_image_s *img;
+    compile_ctx_s ctx;
+
+    ASRT(prog);
+
+    ENO(img = malloc(sizeof(bytecode_image_s)));
+
+    img->len = img->opnd_len = img->strs_len = img->local_cnt = img->global_cnt = 0;
+    img->global_vars = NULL;
+    img->fused = NULL;
+    img->loops = NULL;
+    img->loop_at = NULL;
+    img->refcnt = 1;
+    img->map = NULL;
+    img->map_len = 0;
+
+    img->size = DEFAULT_BYTECODE_LEN;
+    ENO(img->code = malloc(sizeof(bytecode_s) * img->size));
+
+    img->opnd_size = DEFAULT_OPERAND_POOL_LEN;
+    ENO(img->opnds = malloc(sizeof(operand_s) * img->opnd_size));
+
+    img->strs_size = DEFAULT_STRING_POOL_LEN;
+    ENO(img->strs = malloc(img->strs_size));
+
+    img->locals_size = DEFAULT_SYMBOL_TABLE_LEN;
+    ENO(img->locals = malloc(sizeof(size_t) * img->locals_size));
+
+    img->globals_size = DEFAULT_SYMBOL_TABLE_LEN;
+    ENO(img->globals = malloc(sizeof(size_t) * img->globals_size));
+
+    ctx.prog = prog;
+    ctx.img = img;
+    ENO(ctx.lines = malloc(sizeof(source_line_s) * img->size));
+    VDS(ctx.labels = QuadHash_init(DEFAULT_LABEL_TABLE_LEN, symbol_name_cmp, NULL, &verr), verr);
+    VDS(ctx.symbols = QuadHash_init(DEFAULT_SYMBOL_TABLE_LEN, symbol_name_cmp, NULL, &verr), verr);
+    VDS(ctx.global_symbols = QuadHash_init(DEFAULT_SYMBOL_TABLE_LEN, symbol_name_cmp, NULL, &verr), verr);
+
+    parse_magic(prog);
+
+    while (prog->state == INSTRUCTION_LINE) {
+
+        tokenize_next_line(prog);
+
+        if (prog->error_flag) {
+            break;
+        }
+
+        if (!translate_line(&ctx) || prog->c == EOF) {
+            break;
+        }
+    }
+
+    if (!prog->error_flag && resolve_labels(&ctx) && translate_operands(&ctx)) {
+        optimize_image(prog, img);
+        specialize_instructions(img);
+    }
+
+    //the symbols and the tokens of the lines are released with the scratch arena
+    QuadHash_destroy(&ctx.labels, NULL, NULL);
+    QuadHash_destroy(&ctx.symbols, NULL, NULL);
+    QuadHash_destroy(&ctx.global_symbols, NULL, NULL);
+    free(ctx.lines);
+
+    if (prog->error_flag) {
+        bytecode_free(img);
+        return NULL;
+    }
+
+    bytecode_bind_globals(img);
+
+    dbg_msg(prog, "compiled %zu instructions with %zu local variables and %zu globals",
+            img->len, img->local_cnt, img->global_cnt);
+
+    return img;
+}
+
+void bytecode_free(bytecode_image_s *img)
+{
+    if (img) {
+        if (img->map) {
+            munmap(img->map, img->map_len);
+        } else {
+            free(img->code);
+            free(img->opnds);
+            free(img->strs);
+            free(img->locals);
+            free(img->globals);
+        }
+
+        free(img->fused);
+        loop_free(img);
+        free(img->global_vars);
+        free(img);
+    }
+}
+
+/* the path of the image file of a source file */
+char *bytecode_file_path(const char *src_path, struct stat *st, const char *ext)
+{
+    const char *dir = getenv(SIMBLY_CACHE_DIR_ENV);
+    char *file;
+    size_t len;
+
+    if (dir && *dir) {
+        //the same file can be run from different paths, so name it after its inode
+        len = strlen(dir) + 2 * 16 + sizeof("/-") + strlen(ext);
+        ENO(file = malloc(len));
+        snprintf(file, len, "%s/%llx-%llx%s", dir,
+                 (unsigned long long)st->st_dev, (unsigned long long)st->st_ino, ext);
+    } else {
+        len = strlen(src_path) + strlen(ext) + 1;
+        ENO(file = malloc(len));
+        snprintf(file, len, "%s%s", src_path, ext);
+    }
+
+    return file;
+}
+
+void image_file_layout(const bytecode_file_hdr_s *hdr, file_layout_s *layout)
+{
+    layout->locals = ALIGN_8(sizeof(bytecode_file_hdr_s));
+    layout->globals = ALIGN_8(layout->locals + hdr->local_cnt * sizeof(size_t));
+    layout->code = ALIGN_8(layout->globals + hdr->global_cnt * sizeof(size_t));
+    layout->opnds = ALIGN_8(layout->code + hdr->code_len * sizeof(bytecode_s));
+    layout->strs = ALIGN_8(layout->opnds + hdr->opnd_len * sizeof(operand_s));
+    layout->total = layout->strs + hdr->strs_len;
+}
+
+/* maps the image file of a source file, if there's one that was written by this
+ * build from the current version of the source. The image is used as is; it's
+ * not validated again, apart from its header */
+bytecode_image_s *image_file_load(program_s *prog, const char *file, struct stat *st)
+{
+    bytecode_image_s *img;
+    bytecode_file_hdr_s *hdr;
+    file_layout_s layout;
+    struct stat file_st;
+    char *map;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    if (fstat(fd, &file_st) == -1 || (size_t)file_st.st_size < sizeof(bytecode_file_hdr_s)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, (size_t)file_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    hdr = (bytecode_file_hdr_s*)map;
+    image_file_layout(hdr, &layout);
+
+    if (memcmp(hdr->magic, BYTECODE_FILE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != BYTECODE_FILE_VERSION ||
+        hdr->ins_size != sizeof(bytecode_s) ||
+        hdr->opnd_size != sizeof(operand_s) ||
+        hdr->ins_cnt != INSTRUCTION_CNT ||
+        hdr->src_size != (uint64_t)st->st_size ||
+        hdr->src_ino != (uint64_t)st->st_ino ||
+        hdr->src_mtime_sec != (int64_t)st->st_mtim.tv_sec ||
+        hdr->src_mtime_nsec != (int64_t)st->st_mtim.tv_nsec ||
+        layout.total != (size_t)file_st.st_size) {
+
+        dbg_msg(prog, "image file %s is out of date", file);
+        munmap(map, (size_t)file_st.st_size);
+        return NULL;
+    }
+
+    ENO(img = malloc(sizeof(bytecode_image_s)));
+
+    img->locals = (size_t*)(map + layout.locals);
+    img->globals = (size_t*)(map + layout.globals);
+    img->code = (bytecode_s*)(map + layout.code);
+    img->opnds = (operand_s*)(map + layout.opnds);
+    img->strs = map + layout.strs;
+
+    img->local_cnt = img->locals_size = hdr->local_cnt;
+    img->global_cnt = img->globals_size = hdr->global_cnt;
+    img->len = img->size = hdr->code_len;
+    img->opnd_len = img->opnd_size = hdr->opnd_len;
+    img->strs_len = img->strs_size = hdr->strs_len;
+
+    img->fused = NULL;
+    img->loops = NULL;
+    img->loop_at = NULL;
+    img->refcnt = 1;
+    img->map = (void*)map;
+    img->map_len = (size_t)file_st.st_size;
+
+    bytecode_bind_globals(img);
+
+    dbg_msg(prog, "loaded %zu instructions from image file %s", img->len, file);
+
+    return img;
+}
+
+/* saves a compiled image so that the next runs of the interpreter can map it
+ * instead of compiling the source again. Failing to save it isn't an error */
+void image_file_write(program_s *prog, bytecode_image_s *img, const char *file, struct stat *st)
+{
+    bytecode_file_hdr_s hdr;
+    file_layout_s layout;
+    char *buf, *tmp;
+    size_t tmp_len;
+    ssize_t written;
+    int fd;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BYTECODE_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = BYTECODE_FILE_VERSION;
+    hdr.ins_size = sizeof(bytecode_s);
+    hdr.opnd_size = sizeof(operand_s);
+    hdr.ins_cnt = INSTRUCTION_CNT;
+    hdr.src_size = (uint64_t)st->st_size;
+    hdr.src_ino = (uint64_t)st->st_ino;
+    hdr.src_mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    hdr.src_mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+    hdr.code_len = img->len;
+    hdr.opnd_len = img->opnd_len;
+    hdr.strs_len = img->strs_len;
+    hdr.local_cnt = img->local_cnt;
+    hdr.global_cnt = img->global_cnt;
+
+    image_file_layout(&hdr, &layout);
+
+    ENO(buf = calloc(layout.total, 1));
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + layout.locals, img->locals, img->local_cnt * sizeof(size_t));
+    memcpy(buf + layout.globals, img->globals, img->global_cnt * sizeof(size_t));
+    memcpy(buf + layout.code, img->code, img->len * sizeof(bytecode_s));
+    memcpy(buf + layout.opnds, img->opnds, img->opnd_len * sizeof(operand_s));
+    memcpy(buf + layout.strs, img->strs, img->strs_len);
+
+    //write to a temporary file first, so that nobody maps a half written image
+    tmp_len = strlen(file) + 32;
+    ENO(tmp = malloc(tmp_len));
+    snprintf(tmp, tmp_len, "%s.%ld.%lu.tmp", file, (long)getpid(),
+             __atomic_add_fetch(&image_tmp_cnt, 1, __ATOMIC_RELAXED));
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd != -1) {
+        written = write(fd, buf, layout.total);
+        close(fd);
+
+        if (written == (ssize_t)layout.total && !rename(tmp, file)) {
+            dbg_msg(prog, "saved image file %s", file);
+        } else {
+            unlink(tmp);
+            dbg_msg(prog, "couldn't save image file %s", file);
+        }
+    } else {
+        dbg_msg(prog, "couldn't save image file %s", file);
+    }
+
+    free(tmp);
+    free(buf);
+}
+
+/* returns the compiled image of the source file of the program. Every
+ * program that runs the same version of a file shares the same image, so
+ * the file is only compiled the first time it's run, or after it changes.
+ * The cache is only locked to look the file up and to insert its image, so
+ * runtimes that release images don't wait for a file to compile */
+bytecode_image_s *bytecode_load(program_s *prog)
+{
+    vdsErrCode verr;
+    KeyValuePair *pair;
+    bytecode_image_s *img;
+    struct stat st;
+    char *path, *file;
+    size_t path_len;
+
+    ASRT(prog && image_cache_initialized);
+
+    ERR(path = realpath(prog->fname, NULL), !path);
+    ERR(int stat_ret = stat(path, &st), stat_ret == -1);
+
+    path_len = strlen(path) + 1;
+
+    PTH(pthread_mutex_lock(&image_cache_lock));
+
+    VDS(pair = QuadHash_find(image_cache, (void*)path, path_len, &verr), verr);
+
+    if (pair && !image_is_stale((bytecode_image_s*)pair->pData, &st)) {
+        img = (bytecode_image_s*)pair->pData;
+        img->refcnt++;
+
+        PTH(pthread_mutex_unlock(&image_cache_lock));
+
+        dbg_msg(prog, "using the cached image of %s", path);
+        free(path);
+        return img;
+    }
+
+    PTH(pthread_mutex_unlock(&image_cache_lock));
+
+    file = bytecode_file_path(path, &st, BYTECODE_FILE_EXT);
+
+    if (!(img = image_file_load(prog, file, &st))) {
+
+        lexer_map_source(prog);
+        VDS(prog->translated_line = RingBuffer_init(DEFAULT_TRANSLATED_LINE_LEN, &verr), verr);
+
+        img = bytecode_compile(prog);
+
+        //the source file and the scanner buffers aren't needed after compiling
+        lexer_unmap_source(prog);
+        RingBuffer_destroy(&prog->translated_line, NULL, NULL);
+        prog->translated_line = NULL;
+        arena_destroy(&prog->scratch);
+
+        if (img) {
+            image_file_write(prog, img, file, &st);
+        }
+    }
+
+    free(file);
+
+    //images with errors aren't cached, so that each run reports them
+    if (!img) {
+        free(path);
+        return NULL;
+    }
+
+    fuse_instructions(img);
+    loop_recognize(img);
+
+    img->dev = st.st_dev;
+    img->ino = st.st_ino;
+    img->mtime = st.st_mtim;
+
+    PTH(pthread_mutex_lock(&image_cache_lock));
+
+    //another program may have loaded the same file in the meantime
+    VDS(pair = QuadHash_find(image_cache, (void*)path, path_len, &verr), verr);
+
+    if (pair && !image_is_stale((bytecode_image_s*)pair->pData, &st)) {
+        bytecode_image_s *cached = (bytecode_image_s*)pair->pData;
+
+        cached->refcnt++;
+
+        PTH(pthread_mutex_unlock(&image_cache_lock));
+
+        //nobody else has a reference to this one
+        bytecode_free(img);
+        free(path);
+        return cached;
+    }
+
+    img->refcnt++; //the reference of the cache
+
+    if (pair) {
+        //the file was modified; programs that still run the old
+        //version keep their own reference to the old image
+        image_unref((bytecode_image_s*)pair->pData);
+        pair->pData = (void*)img;
+        free(path);
+    } else {
+        VDS(QuadHash_insert(image_cache, (void*)img, (void*)path, path_len, NULL, &verr), verr);
+    }
+
+    PTH(pthread_mutex_unlock(&image_cache_lock));
+
+    return img;
+}
+
+void bytecode_release(bytecode_image_s *img)
+{
+    if (img) {
+        PTH(pthread_mutex_lock(&image_cache_lock));
+        image_unref(img);
+        PTH(pthread_mutex_unlock(&image_cache_lock));
+    }
+}
+
+void bytecode_cache_init(void)
+{
+    if (!image_cache_initialized) {
+        vdsErrCode verr;
+
+        VDS(image_cache = QuadHash_init(IMAGE_CACHE_INIT_SIZE, symbol_name_cmp, NULL, &verr), verr);
+
+        image_cache_initialized = 1;
+    }
+}
+
+void bytecode_cache_destroy(void)
+{
+    if (image_cache_initialized) {
+        PTH(pthread_mutex_lock(&image_cache_lock));
+        QuadHash_destroy(&image_cache, free_cached_image_cb, NULL);
+        image_cache_initialized = 0;
+        PTH(pthread_mutex_unlock(&image_cache_lock));
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef SIMBLY_BYTECODE_H__
+#define SIMBLY_BYTECODE_H__
+
+#include "common.h"
+#include "program.h"
+#include "scanner.h"
+#include "exec.h"
+#include "global.h"
+#include <sys/stat.h>
+
+
+#define DEFAULT_BYTECODE_LEN 32
+#define DEFAULT_OPERAND_POOL_LEN 64
+#define DEFAULT_STRING_POOL_LEN 256
+#define DEFAULT_LABEL_TABLE_LEN 8
+#define DEFAULT_SYMBOL_TABLE_LEN 16
+#define IMAGE_CACHE_INIT_SIZE 16
+
+/* compiled images are saved to files with the source file name plus this
+ * extension, or to the directory in SIMBLY_CACHE_DIR_ENV if it's set */
+#define BYTECODE_FILE_EXT ".sbc"
+#define BYTECODE_FILE_MAGIC "SIMBLYBC"
+#define BYTECODE_FILE_VERSION 8
+#define SIMBLY_CACHE_DIR_ENV "SIMBLY_CACHE_DIR"
+
+typedef enum _operand_kind_e {
+    IMM_OPND,           //val is the integer value
+    LOCAL_OPND,         //val is the slot of the local in the register file
+    LOCAL_ARR_OPND,     //val is the slot of the local, idx is the index operand
+    LOCAL_ELEM_OPND,    //same as above, with an integer index that's always in the array
+    ARGC_OPND,
+    ARGV_OPND,          //idx is the index operand
+    GLOBAL_OPND,        //val is the index of the global in the symbol table of the image
+    GLOBAL_ARR_OPND,    //same as above, idx is the index operand
+    STRING_OPND,        //val is the offset of the string in the string pool
+    LABEL_OPND          //val is the index of the instruction to jump to
+} operand_kind_e;
+
+/* operands refer to each other, and to the strings, with indices instead
+ * of pointers so that the whole image can be moved around */
+typedef struct _operand_s {
+    operand_kind_e kind;
+    int val, idx;
+} operand_s;
+
+/* a single decoded source line. Its operands are stored contiguously
+ * in the operand pool of the image, starting from args */
+typedef struct _bytecode_s {
+    instruction_id_e code;
+    unsigned int args, argc;
+    unsigned int line, column, prev_col;
+} bytecode_s;
+
+typedef struct _bytecode_image_s {
+    bytecode_s *code;
+    bytecode_s *fused; //code with superinstructions, built when the image is loaded
+    struct _loop_s *loops; //the counted loops of the code, found when the image is loaded
+    size_t loop_cnt;
+    struct _loop_s **loop_at; //the loop that starts at each instruction, if any
+    size_t len, size;
+    operand_s *opnds;
+    size_t opnd_len, opnd_size;
+    char *strs;
+    size_t strs_len, strs_size;
+    size_t *locals; //offset of the name of each local slot in the string pool
+    size_t local_cnt, locals_size;
+    size_t *globals; //offset of the name of each global symbol in the string pool
+    size_t global_cnt, globals_size;
+    global_var_s **global_vars; //the global each symbol is bound to
+    //images are shared between every program that runs the same source
+    //file; these identify the version of the file the image was compiled from
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    unsigned int refcnt;
+    void *map; //the mapping of the image file, if the image was loaded from one
+    size_t map_len;
+} bytecode_image_s;
+
+/* header of an image file. It's followed by the locals, globals, code,
+ * operand and string pool arrays of the image, each aligned to 8 bytes.
+ * Images are only valid for the build of simbly that wrote them */
+typedef struct _bytecode_file_hdr_s {
+    char magic[8];
+    uint32_t version, ins_size, opnd_size, ins_cnt;
+    uint64_t src_size, src_ino;
+    int64_t src_mtime_sec, src_mtime_nsec;
+    uint64_t code_len, opnd_len, strs_len, local_cnt, global_cnt;
+} bytecode_file_hdr_s;
+
+
+bytecode_image_s *bytecode_compile(program_s *prog);
+void bytecode_bind_globals(bytecode_image_s *img);
+void bytecode_free(bytecode_image_s *img);
+bytecode_image_s *bytecode_load(program_s *prog);
+void bytecode_release(bytecode_image_s *img);
+void bytecode_cache_init(void);
+void bytecode_cache_destroy(void);
+instruction_id_e bytecode_base_code(instruction_id_e code);
+unsigned char *bytecode_array_locals(bytecode_image_s *img);
+char *bytecode_file_path(const char *src_path, struct stat *st, const char *ext);
+
+#endif //SIMBLY_BYTECODE_H__
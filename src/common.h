@@ -15,14 +15,24 @@
 /* Let's set some limits */
 #define MAX_INPUT_STR_LEN 1023
 
-#define MAX_INT_ARRAY_LEN 4096
+//local and global arrays can't have more elements than this
+#ifndef MAX_INT_ARRAY_LEN
+# define MAX_INT_ARRAY_LEN (1 << 24)
+#endif
 
 #define MAX_INT_STR_LEN 9
 
 //MAX_ALLOWED_SYMBOL_LEN always has to be less than MAX_INPUT_STR_LEN!!!
 #define MAX_ALLOWED_SYMBOL_LEN 127
 
-#define GLOBAL_TABLE_INIT_SIZE 24
+//has to be a power of 2
+#define GLOBAL_TABLE_INIT_SIZE 256
+
+//buckets of the wait queues of a global, when a program first blocks on it. Has to be a power of 2
+#define WAIT_QUEUE_INIT_BUCKETS 16
+
+//data that's shared between threads is kept apart by this many bytes
+#define CACHE_LINE_SIZE 64
 
 #define ARRAY_LEN(x) (sizeof(x) / sizeof(x[0]))
 #define MAKE_STR(x) #x
@@ -1,914 +1,984 @@
 #include "exec.h"
 #include "scanner.h"
+#include "bytecode.h"
 #include "global.h"
+#include "jit.h"
+#include "vector.h"
+#include "loop.h"
 #include "error.h"
+#include <limits.h>
 
-#define SET_PARSER_IDX(prog, tok) \
-do { \
-    unsigned int ___tmp_line = prog->line, \
-                 ___tmp_col = prog->column, \
-                 ___tmp_prev_col = prog->prev_col; \
-    prog->line = tok->line; \
-    prog->column = tok->column; \
-    prog->prev_col = tok->prev_col \
-
-#define RESET_PARSER_IDX(prog) \
-    prog->line = ___tmp_line; \
-    prog->column = ___tmp_col; \
-    prog->prev_col = ___tmp_prev_col; \
-} while (0)
+/* GCC and Clang can jump straight to the body of the next instruction
+ * through a table of label addresses (direct threading). Other compilers
+ * get a plain switch loop */
+#if defined(__GNUC__) && !defined(SIMBLY_NO_COMPUTED_GOTO)
+# define SIMBLY_COMPUTED_GOTO
+#endif
 
 int exec_initialized = 0;
 pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static int __varval_get_value(program_s *prog, token_type_e type, varval_u *data, size_t len, int *value);
-static int __varval_set_value(program_s *prog, token_type_e type, varval_u *data, size_t len, int to_set);
+static void set_error_position(program_s *prog);
+static const char *local_name(program_s *prog, int slot);
+static int check_index(program_s *prog, int idx, const char *name);
+static int *local_elem(program_s *prog, int slot, int idx);
+static int *operand_elem(program_s *prog, const operand_s *op);
+static int operand_get_value(program_s *prog, const operand_s *op, int *value);
+static int operand_set_value(program_s *prog, const operand_s *op, int to_set);
+static global_var_s *global_operand(program_s *prog, const operand_s *op, size_t *idx);
+
+static void sleep_handler(program_s *prog, const bytecode_s *ins, const operand_s *args);
+static void print_handler(program_s *prog, const bytecode_s *ins, const operand_s *args);
+static int check_range(program_s *prog, int start, int cnt, const char *name);
+static int vector_count(program_s *prog, const bytecode_s *ins, const operand_s *args, int *cnt);
+static int vector_range(program_s *prog, const operand_s *op, int cnt, int *start);
+static int vector_ranges(instruction_id_e code, local_var_s *dst_var, int dst_start, local_var_s **src_var,
+                         const int *src_start, unsigned int src_cnt, int val, int cnt, int acc);
+static void vector_handler(program_s *prog, const bytecode_s *ins, const operand_s *args);
+static void transfer_handler(program_s *prog, const bytecode_s *ins, const operand_s *args);
+static void atomic_handler(program_s *prog, const bytecode_s *ins, const operand_s *args);
+static int loop_value(program_s *prog, const operand_s *op, int *value);
+static int loop_handler(program_s *prog, const loop_s *loop);
 
-static int varval_set_value(program_s *prog, token_s *tok, int to_set);
-static int varval_get_value(program_s *prog, token_s *tok, int *to_get);
+static void exec_destroy(void);
 
-static label_data_s *insert_label_to_vartable(program_s *prog, token_s *lbl_tok);
+/* the source position of the instruction being executed is only copied to
+ * the program when an error or warning has to point at it */
+void set_error_position(program_s *prog)
+{
+    const bytecode_s *ins = &((bytecode_image_s*)prog->image)->code[prog->pc - 1];
 
-//static void __dbg_print_vartable(QuadHashtable *table);
+    prog->line = ins->line;
+    prog->column = ins->column;
+    prog->prev_col = ins->prev_col;
+}
 
-static void load_handler(program_s *prog, instruction_id_e ins_code);
-static void store_handler(program_s *prog, instruction_id_e ins_code);
-static void set_handler(program_s *prog, instruction_id_e ins_code);
-static void primitive_op_handler(program_s *prog, instruction_id_e ins_code);
-static void branch_handler(program_s *prog, instruction_id_e ins_code);
-static void semaphore_handler(program_s *prog, instruction_id_e ins_code);
-static void sleep_handler(program_s *prog, instruction_id_e ins_code);
-static void print_handler(program_s *prog, instruction_id_e ins_code);
-static void return_handler(program_s *prog, instruction_id_e ins_code);
+const char *local_name(program_s *prog, int slot)
+{
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
 
-static void exec_instruction_line(program_s *prog);
-static void exec_destroy(void);
+    return &img->strs[img->locals[slot]];
+}
 
-static const instruction_s instruction_array[] = {
-    {"LOAD", LOAD_SYM, load_handler},
-    {"STORE", STORE_SYM, store_handler},
-    {"SET", SET_SYM, set_handler},
-    {"ADD", ADD_SYM, primitive_op_handler},
-    {"SUB", SUB_SYM, primitive_op_handler},
-    {"MUL", MUL_SYM, primitive_op_handler},
-    {"DIV", DIV_SYM, primitive_op_handler},
-    {"MOD", MOD_SYM, primitive_op_handler},
-    {"BRGT", BRGT_SYM, branch_handler},
-    {"BRGE", BRGE_SYM, branch_handler},
-    {"BRLT", BRLT_SYM, branch_handler},
-    {"BRLE", BRLE_SYM, branch_handler},
-    {"BREQ", BREQ_SYM, branch_handler},
-    {"BRA", BRA_SYM, branch_handler},
-    {"DOWN", DOWN_SYM, semaphore_handler},
-    {"UP", UP_SYM, semaphore_handler},
-    {"SLEEP", SLEEP_SYM, sleep_handler},
-    {"PRINT", PRINT_SYM, print_handler},
-    {"RETURN", RETURN_SYM, return_handler}
-};
-
-int __varval_get_value(program_s *prog, token_type_e type, varval_u *data, size_t len, int *value)
+/* stops the program if idx can't be the index of an element of the array name */
+int check_index(program_s *prog, int idx, const char *name)
 {
-    vdsErrCode verr;
-    KeyValuePair *table_data;
-    char *search_key;
-    size_t key_len;
-    int final_val;
-
-    if (type == INT_VAL_TOK) {
-        if (value)
-            *value = data->value;
-        return 1;
+    if (idx < 0) {
+        program_stop(prog, 1);
+        set_error_position(prog);
+        err_msg(prog, "arrays can't have negative indices\n\t%s\n\t^", name);
+        return 0;
     }
 
-    switch (type) {
-        case INT_VAR_TOK:
-            if (len) {
-                key_len = len;
-            } else {
-                key_len = strlen(data->ptr) + 1;
-            }
-            search_key = data->ptr;
-
-            if (!strcmp("argc", search_key)) {
-                free(search_key);
-                if (value)
-                    *value = prog->argv[1];
-                return 1;
-            }
-            break;
-        case INT_ARR_TOK:
-            search_key = ((int_arr_tok_s*)data->ptr)->name;
-            key_len = strlen(search_key) + 1;
-
-            if (!strcmp("argv", search_key)) {
-                int tmp_idx;
-
-                if (!__varval_get_value(prog, ((int_arr_tok_s*)data->ptr)->idx_type, &((int_arr_tok_s*)data->ptr)->idx, 0, &tmp_idx)) {
-                    return 0;
-                }
+    if ((size_t)idx >= MAX_INT_ARRAY_LEN) {
+        program_stop(prog, 1);
+        set_error_position(prog);
+        err_msg(prog, "arrays can't have more than %d elements\n\t%s\n\t^", MAX_INT_ARRAY_LEN, name);
+        return 0;
+    }
 
-                if (tmp_idx >= prog->argv[1]) {
-                    program_stop(prog, 1);
-                    err_msg(prog, "tried to access area outside of argv array which is of size %d\n\t%s\n\t^", prog->argv[1], search_key);
-                    return 0;
-                }
+    return 1;
+}
 
-                free(search_key);
-                free(data->ptr);
+/* returns a pointer to the element idx of a local variable, allocating
+ * the page of the element if it doesn't exist */
+int *local_elem(program_s *prog, int slot, int idx)
+{
+    local_var_s *var = &prog->locals[slot];
 
-                if (value)
-                    *value = prog->argv[tmp_idx + 2];
-                return 1;
-            }
-            break;
-        default:
-            return 0;
+    if (!check_index(prog, idx, local_name(prog, slot))) {
+        return NULL;
     }
 
-    VDS(table_data = QuadHash_find(prog->vartable, (void*)search_key, key_len, &verr), verr);
+    return idx ? int_array_elem(&var->arr, (size_t)idx) : &var->val;
+}
+
+/* returns a pointer to the register file entry of a local variable operand */
+int *operand_elem(program_s *prog, const operand_s *op)
+{
+    const operand_s *opnds = ((bytecode_image_s*)prog->image)->opnds;
+    int idx;
 
-    if (table_data) {
+    if (op->kind == LOCAL_OPND) {
 
-        if (*(int*)table_data->pData == -1) {
+        //only elements other than the first are stored in arr
+        if (prog->locals[op->val].arr.len) {
             program_stop(prog, 1);
-            err_msg(prog, "there's already a label with the same name defined\n\t%s\n\t^", search_key);
-            return 0;
+            set_error_position(prog);
+            err_msg(prog, "arrays can't be used by their names; only by their indices\n\t%s\n\t^",
+                    local_name(prog, op->val));
+            return NULL;
         }
 
-        int *arr = (int*)table_data->pData;
-
-        switch (type) {
-            case INT_VAR_TOK:
-            {
-
-                if (arr[0] > 1) {
-                    program_stop(prog, 1);
-                    err_msg(prog, "arrays can't be used by their names; only by their indices\n\t%s\n\t^", search_key);
-                    return 0;
-                }
-
-                final_val = arr[1];
-                free(search_key);
-                break;
-            }
-            case INT_ARR_TOK:
-            {
-
-                int tmp;
-
-                if (!__varval_get_value(prog, ((int_arr_tok_s*)data->ptr)->idx_type, &((int_arr_tok_s*)data->ptr)->idx, 0, &tmp)) {
-                    return 0;
-                }
+        return &prog->locals[op->val].val;
+    }
 
-                if (tmp < 0) {
-                    program_stop(prog, 1);
-                    err_msg(prog, "arrays can't have negative indices\n\t%s\n\t^", search_key);
-                    return 0;
-                }
+    //the index was checked, and the page of the element allocated, before the program started
+    if (op->kind == LOCAL_ELEM_OPND) {
+        local_var_s *var = &prog->locals[op->val];
 
-                tmp++;
-                if (tmp >= (arr[0] + 1)) {
-                    ENO(arr = realloc(arr, sizeof(int) * (tmp + 1)));
+        idx = opnds[op->idx].val;
+        return idx ? &var->arr.pages[idx >> INT_ARRAY_PAGE_SHIFT][idx & INT_ARRAY_PAGE_MASK] : &var->val;
+    }
 
+    ASRT(op->kind == LOCAL_ARR_OPND);
 
-                    for (int i = arr[0]; i < (tmp + 1); i++)
-                        arr[i] = 0;
+    if (!operand_get_value(prog, &opnds[op->idx], &idx)) {
+        return NULL;
+    }
 
-                    arr[0] = tmp;
-                    final_val = 0;
-                    table_data->pData = arr;//FU
-                } else {
-                    final_val = arr[tmp];
-                }
+    return local_elem(prog, op->val, idx);
+}
 
-                free(search_key);
-                free(data->ptr);
-                break;
-            }
-            default:
+int operand_get_value(program_s *prog, const operand_s *op, int *value)
+{
+    const operand_s *opnds = ((bytecode_image_s*)prog->image)->opnds;
+    int *elem, idx;
+
+    switch (op->kind) {
+        case IMM_OPND:
+            *value = op->val;
+            return 1;
+        case ARGC_OPND:
+            *value = prog->argv[1];
+            return 1;
+        case ARGV_OPND:
+            if (!operand_get_value(prog, &opnds[op->idx], &idx)) {
                 return 0;
-        }
-
-    } else {
+            }
 
-        int *new_array;
+            if (idx < 0 || idx >= prog->argv[1]) {
+                program_stop(prog, 1);
+                set_error_position(prog);
+                err_msg(prog, "tried to access area outside of argv array which is of size %d\n\targv\n\t^", prog->argv[1]);
+                return 0;
+            }
 
-        final_val = 0;
+            *value = prog->argv[idx + 2];
+            return 1;
+        case LOCAL_ARR_OPND:
+            //reading an element that was never written doesn't allocate its page
+            if (!operand_get_value(prog, &opnds[op->idx], &idx) ||
+                !check_index(prog, idx, local_name(prog, op->val))) {
+                return 0;
+            }
 
-        switch (type) {
-            case INT_VAR_TOK:
-            {
-                ENO(new_array = malloc(sizeof(int) * 2));
-                new_array[0] = 1;
-                new_array[1] = 0;
+            *value = idx ? int_array_get(&prog->locals[op->val].arr, (size_t)idx) : prog->locals[op->val].val;
+            return 1;
+        default:
+            elem = operand_elem(prog, op);
 
-                break;
+            if (!elem) {
+                return 0;
             }
-            case INT_ARR_TOK:
-            {
-                int tmp;
 
-                if (!__varval_get_value(prog, ((int_arr_tok_s*)data->ptr)->idx_type, &((int_arr_tok_s*)data->ptr)->idx, 0, &tmp)) {
-                    return 0;
-                }
+            *value = *elem;
+            return 1;
+    }
+}
 
-                if (tmp < 0) {
-                    program_stop(prog, 1);
-                    err_msg(prog, "arrays can't have negative indices\n\t%s\n\t^", search_key);
-                    return 0;
-                }
+int operand_set_value(program_s *prog, const operand_s *op, int to_set)
+{
+    int *elem = operand_elem(prog, op);
 
-                tmp++;
+    if (!elem) {
+        return 0;
+    }
 
-                ENO(new_array = malloc(sizeof(int) * (tmp + 1)));
+    *elem = to_set;
+    return 1;
+}
 
-                new_array[0] = tmp;
+/* finds the global variable, and the index in it, that a LOAD/STORE/DOWN/UP
+ * operand refers to. Returns NULL if the array index couldn't be evaluated */
+global_var_s *global_operand(program_s *prog, const operand_s *op, size_t *idx)
+{
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
 
-                for (int i = 1; i < (tmp + 1); i++)
-                    new_array[i] = 0;
+    *idx = 0;
 
-                free(data->ptr);
-                break;
-            }
-            default:
-                return 0;
-        }
+    if (op->kind == GLOBAL_ARR_OPND) {
+        int tmp;
 
-        VDS(QuadHash_insert(prog->vartable, (void*)new_array, (void*)search_key, key_len, NULL, &verr), verr);
+        if (!operand_get_value(prog, &img->opnds[op->idx], &tmp)) {
+            return NULL;
+        }
 
-    }
+        if (!check_index(prog, tmp, &img->strs[img->globals[op->val]])) {
+            return NULL;
+        }
 
-    if (value) {
-        *value = final_val;
+        *idx = tmp;
     }
 
-    return 1;
+    return img->global_vars[op->val];
 }
 
-int __varval_set_value(program_s *prog, token_type_e type, varval_u *data, size_t len, int to_set)
+/* fetches the next instruction, unless the program can't go on running */
+#define FETCH() \
+do { \
+    if (prog->state != INSTRUCTION_LINE || cnt >= max_cnt) { \
+        goto stop; \
+    } \
+    if (prog->pc >= img->len) { \
+        prog->state = FINISHED; \
+        goto stop; \
+    } \
+    ins = &code[prog->pc++]; \
+    args = &img->opnds[ins->args]; \
+    cnt++; \
+} while (0)
+
+#ifdef SIMBLY_COMPUTED_GOTO
+# define OPCODE(code) code##_LBL:
+# define DISPATCH() \
+do { \
+    FETCH(); \
+    goto *dispatch_table[ins->code]; \
+} while (0)
+//runs ins without fetching it
+# define REDISPATCH() goto *dispatch_table[ins->code]
+#else
+# define OPCODE(code) case code:
+# define DISPATCH() continue
+# define REDISPATCH() goto redispatch
+#endif
+
+/* the register file entry of an operand of the REG_SHAPE */
+#define REG(op) (regs[(op).val].val)
+
+#define ARITHMETIC_OPS(name, op) \
+    OPCODE(name##_SYM) \
+    if (operand_get_value(prog, &args[1], &val1) && \
+        operand_get_value(prog, &args[2], &val2)) { \
+        (void)operand_set_value(prog, &args[0], val1 op val2); \
+    } \
+    DISPATCH(); \
+\
+    OPCODE(name##_RRR_SYM) \
+    REG(args[0]) = REG(args[1]) op REG(args[2]); \
+    DISPATCH(); \
+\
+    OPCODE(name##_RRI_SYM) \
+    REG(args[0]) = REG(args[1]) op args[2].val; \
+    DISPATCH(); \
+\
+    OPCODE(name##_RIR_SYM) \
+    REG(args[0]) = args[1].val op REG(args[2]); \
+    DISPATCH();
+
+#define BRANCH_OPS(name, op) \
+    OPCODE(name##_SYM) \
+    if (operand_get_value(prog, &args[0], &val1) && \
+        operand_get_value(prog, &args[1], &val2) && \
+        (val1 op val2)) { \
+        prog->pc = (size_t)args[2].val; \
+    } \
+    DISPATCH(); \
+\
+    OPCODE(name##_RR_SYM) \
+    if (REG(args[0]) op REG(args[1])) \
+        prog->pc = (size_t)args[2].val; \
+    DISPATCH(); \
+\
+    OPCODE(name##_RI_SYM) \
+    if (REG(args[0]) op args[1].val) \
+        prog->pc = (size_t)args[2].val; \
+    DISPATCH(); \
+\
+    OPCODE(name##_IR_SYM) \
+    if (args[0].val op REG(args[1])) \
+        prog->pc = (size_t)args[2].val; \
+    DISPATCH();
+
+/* superinstructions. The operands of every instruction of the sequence
+ * follow each other, and FETCH has only moved pc past the first one */
+#define FUSED_ARITHMETIC_OPS(name, op) \
+    OPCODE(name##_RRI_BRA_SYM) \
+    REG(args[0]) = REG(args[1]) op args[2].val; \
+    prog->pc = (size_t)args[3].val; \
+    DISPATCH(); \
+\
+    OPCODE(name##_GLOBAL_SYM) \
+    var = img->global_vars[args[1].val]; \
+    REG(args[0]) = __atomic_load_n(&var->val, __ATOMIC_ACQUIRE); \
+    REG(args[2]) = REG(args[3]) op ((args[4].kind == IMM_OPND) ? args[4].val : REG(args[4])); \
+    global_var_store(var, 0, REG(args[6])); \
+    prog->pc += 2; \
+    DISPATCH();
+
+#define FUSED_BRANCH_OPS(name, op) \
+    OPCODE(INC_##name##_RR_SYM) \
+    REG(args[0]) = REG(args[1]) + args[2].val; \
+    prog->pc = (REG(args[3]) op REG(args[4])) ? (size_t)args[5].val : prog->pc + 1; \
+    DISPATCH(); \
+\
+    OPCODE(INC_##name##_RI_SYM) \
+    REG(args[0]) = REG(args[1]) + args[2].val; \
+    prog->pc = (REG(args[3]) op args[4].val) ? (size_t)args[5].val : prog->pc + 1; \
+    DISPATCH();
+
+#ifdef SIMBLY_COMPUTED_GOTO
+# define INSTRUCTION_LABEL(name, handler) [name##_SYM] = &&name##_SYM_LBL,
+# define ARITHMETIC_VARIANT_LABELS(name, op) \
+    [name##_RRR_SYM] = &&name##_RRR_SYM_LBL, \
+    [name##_RRI_SYM] = &&name##_RRI_SYM_LBL, \
+    [name##_RIR_SYM] = &&name##_RIR_SYM_LBL,
+# define BRANCH_VARIANT_LABELS(name, op) \
+    [name##_RR_SYM] = &&name##_RR_SYM_LBL, \
+    [name##_RI_SYM] = &&name##_RI_SYM_LBL, \
+    [name##_IR_SYM] = &&name##_IR_SYM_LBL,
+# define FUSED_ARITHMETIC_LABELS(name, op) \
+    [name##_RRI_BRA_SYM] = &&name##_RRI_BRA_SYM_LBL, \
+    [name##_GLOBAL_SYM] = &&name##_GLOBAL_SYM_LBL,
+# define FUSED_BRANCH_LABELS(name, op) \
+    [INC_##name##_RR_SYM] = &&INC_##name##_RR_SYM_LBL, \
+    [INC_##name##_RI_SYM] = &&INC_##name##_RI_SYM_LBL,
+#endif
+
+#ifdef SIMBLY_COMPUTED_GOTO
+//labels as values are a GNU extension
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/* runs up to max_cnt instructions of a program, until it finishes, stops
+ * because of an error, goes to sleep or blocks on a semaphore. Returns the
+ * number of instructions that were executed */
+size_t interpret_next_lines(program_s *prog, size_t max_cnt)
 {
-    vdsErrCode verr;
-    KeyValuePair *table_data;
-    char *search_key;
-    size_t key_len;
-
-    switch (type) {
-        case INT_VAR_TOK:
-            if (len) {
-                key_len = len;
-            } else {
-                key_len = strlen(data->ptr) + 1;
-            }
-            search_key = data->ptr;
+    bytecode_image_s *img;
+    local_var_s *regs;
+    const bytecode_s *base, *code, *ins;
+    const operand_s *args;
+    global_var_s *var;
+    size_t cnt = 0, idx;
+    int val1, val2;
+
+#ifdef SIMBLY_COMPUTED_GOTO
+    static const void *dispatch_table[INSTRUCTION_CNT] = {
+        INSTRUCTION_LIST(INSTRUCTION_LABEL)
+        [SET_RR_SYM] = &&SET_RR_SYM_LBL,
+        [SET_RI_SYM] = &&SET_RI_SYM_LBL,
+        ARITHMETIC_LIST(ARITHMETIC_VARIANT_LABELS)
+        BRANCH_LIST(BRANCH_VARIANT_LABELS)
+        ARITHMETIC_LIST(FUSED_ARITHMETIC_LABELS)
+        BRANCH_LIST(FUSED_BRANCH_LABELS)
+        [JIT_ENTER_SYM] = &&JIT_ENTER_SYM_LBL,
+        [LOOP_SYM] = &&LOOP_SYM_LBL
+    };
+#endif
 
-            if (!strcmp("argc", search_key)) {
-                program_stop(prog, 1);
-                err_msg(prog, "the value of argc is constant; setting it to another value isn't allowed\n\t%s\n\t^", search_key);
-                return 0;
-            }
-            break;
-        case INT_ARR_TOK:
-            search_key = ((int_arr_tok_s*)data->ptr)->name;
-            key_len = strlen(search_key) + 1;
+    ASRT(exec_initialized);
 
-            if (!strcmp("argv", search_key)) {
-                program_stop(prog, 1);
-                err_msg(prog, "the value of argv is constant; setting it to another value isn't allowed\n\t%s\n\t^", search_key);
-                return 0;
-            }
-            break;
-        default:
-            return 0;
+    if (!prog) {
+        return 0;
     }
 
-    VDS(table_data = QuadHash_find(prog->vartable, (void*)search_key, key_len, &verr), verr);
+    img = (bytecode_image_s*)prog->image;
+    regs = prog->locals;
+    base = (prog->opts & PROGRAM_OPT_NO_FUSION) ? img->code : img->fused;
+    code = prog->jit ? ((jit_s*)prog->jit)->code : base;
 
-    if (table_data) {
+#ifdef SIMBLY_COMPUTED_GOTO
+    DISPATCH();
+#else
+    while (1) {
+        FETCH();
+redispatch:
+        switch (ins->code) {
+#endif
+
+    OPCODE(LOAD_SYM)
+    if ((var = global_operand(prog, &args[1], &idx))) {
+        global_var_load(var, idx, &val1);
+        (void)operand_set_value(prog, &args[0], val1);
+    }
+    DISPATCH();
 
-        if (*(int*)table_data->pData == -1) {
-            program_stop(prog, 1);
-            err_msg(prog, "there's already a label with the same name defined\n\t%s\n\t^", search_key);
-            return 0;
-        }
+    OPCODE(STORE_SYM)
+    if ((var = global_operand(prog, &args[0], &idx)) &&
+        operand_get_value(prog, &args[1], &val1)) {
+        global_var_store(var, idx, val1);
+    }
+    DISPATCH();
 
-        int *arr = (int*)table_data->pData;
+    OPCODE(SET_SYM)
+    if (operand_get_value(prog, &args[1], &val1)) {
+        (void)operand_set_value(prog, &args[0], val1);
+    }
+    DISPATCH();
 
-        switch (type) {
-            case INT_VAR_TOK:
-            {
+    OPCODE(SET_RR_SYM)
+    REG(args[0]) = REG(args[1]);
+    DISPATCH();
 
-                if (arr[0] > 1) {
-                    program_stop(prog, 1);
-                    err_msg(prog, "arrays can't be used by their names; only by their indices\n\t%s\n\t^", search_key);
-                    return 0;
-                }
+    OPCODE(SET_RI_SYM)
+    REG(args[0]) = args[1].val;
+    DISPATCH();
 
-                arr[1] = to_set;
-                free(search_key);
-                break;
-            }
-            case INT_ARR_TOK:
-            {
+    ARITHMETIC_LIST(ARITHMETIC_OPS)
 
-                int tmp;
+    BRANCH_LIST(BRANCH_OPS)
 
-                if (!__varval_get_value(prog, ((int_arr_tok_s*)data->ptr)->idx_type, &((int_arr_tok_s*)data->ptr)->idx, 0, &tmp)) {
-                    return 0;
-                }
+    ARITHMETIC_LIST(FUSED_ARITHMETIC_OPS)
 
-                if (tmp < 0) {
-                    program_stop(prog, 1);
-                    err_msg(prog, "arrays can't have negative indices\n\t%s\n\t^", search_key);
-                    return 0;
-                }
+    BRANCH_LIST(FUSED_BRANCH_OPS)
 
-                tmp++;
-                if (tmp >= (arr[0] + 1)) {
+    OPCODE(JIT_ENTER_SYM)
+    if (!jit_enter(prog, prog->pc - 1, max_cnt - cnt, &cnt)) {
+        //the region isn't compiled; run the instruction it starts with
+        ins = &base[prog->pc - 1];
+        args = &img->opnds[ins->args];
+        REDISPATCH();
+    }
+    DISPATCH();
+
+    OPCODE(LOOP_SYM)
+    if (!loop_handler(prog, img->loop_at[prog->pc - 1])) {
+        //the loop has to be run one iteration at a time; run the instruction it starts with
+        ins = &img->loop_at[prog->pc - 1]->orig;
+        args = &img->opnds[ins->args];
+        REDISPATCH();
+    }
+    DISPATCH();
 
-                    ENO(arr = realloc(arr, sizeof(int) * (tmp + 1)));
+    OPCODE(BRA_SYM)
+    prog->pc = (size_t)args[0].val;
+    DISPATCH();
 
-                    for (int i = arr[0]; i < (tmp + 1); i++)
-                        arr[i] = 0;
+    OPCODE(DOWN_SYM)
+    if ((var = global_operand(prog, &args[0], &idx))) {
+        global_var_down(prog, var, idx);
+    }
+    DISPATCH();
 
-                    arr[0] = tmp;
+    OPCODE(UP_SYM)
+    if ((var = global_operand(prog, &args[0], &idx))) {
+        global_var_up(var, idx);
+    }
+    DISPATCH();
 
-                    table_data->pData = arr;
-                }
+    OPCODE(SLEEP_SYM)
+    OPCODE(MSLEEP_SYM)
+    sleep_handler(prog, ins, args);
+    DISPATCH();
 
-                dbg_msg(prog, "setting the position %d of the array to the value %d", tmp, to_set);
-                arr[tmp] = to_set;
+    OPCODE(PRINT_SYM)
+    print_handler(prog, ins, args);
+    DISPATCH();
 
-                free(search_key);
-                free(data->ptr);
-                break;
-            }
-            default:
-                return 0;
+    OPCODE(RETURN_SYM)
+    prog->state = FINISHED;
+    DISPATCH();
+
+    OPCODE(VADD_SYM)
+    OPCODE(VSUB_SYM)
+    OPCODE(VMUL_SYM)
+    OPCODE(VFILL_SYM)
+    OPCODE(VCOPY_SYM)
+    OPCODE(VSUM_SYM)
+    OPCODE(VMIN_SYM)
+    OPCODE(VMAX_SYM)
+    vector_handler(prog, ins, args);
+    DISPATCH();
+
+    OPCODE(LOADN_SYM)
+    OPCODE(STOREN_SYM)
+    transfer_handler(prog, ins, args);
+    DISPATCH();
+
+    OPCODE(FADD_SYM)
+    OPCODE(SWAP_SYM)
+    OPCODE(CAS_SYM)
+    atomic_handler(prog, ins, args);
+    DISPATCH();
+
+#ifndef SIMBLY_COMPUTED_GOTO
+        case INSTRUCTION_CNT:
+            break;
         }
+    }
+#endif
 
-    } else {
-
-        int *new_array;
-
-        switch (type) {
-            case INT_VAR_TOK:
-            {
-                ENO(new_array = malloc(sizeof(int) * 2));
-                new_array[0] = 1;
-                new_array[1] = to_set;
-
-                break;
-            }
-            case INT_ARR_TOK:
-            {
-                int tmp;
+stop:
+    if (prog->state == INSTRUCTION_LINE && prog->pc >= img->len) {
+        prog->state = FINISHED;
+    }
 
-                if (!__varval_get_value(prog, ((int_arr_tok_s*)data->ptr)->idx_type, &((int_arr_tok_s*)data->ptr)->idx, 0, &tmp)) {
-                    return 0;
-                }
+    return cnt;
+}
 
-                if (tmp < 0) {
-                    program_stop(prog, 1);
-                    err_msg(prog, "arrays can't have negative indices\n\t%s\n\t^", search_key);
-                    return 0;
-                }
+#ifdef SIMBLY_COMPUTED_GOTO
+# pragma GCC diagnostic pop
+#endif
 
-                tmp++;
+/* SLEEP sleeps for seconds and MSLEEP for milliseconds. The program only
+ * records when it can run again; its runtime takes it off the program list
+ * until then, and goes on running the other programs */
+void sleep_handler(program_s *prog, const bytecode_s *ins, const operand_s *args)
+{
+    int sleep_duration;
 
-                //calloc maybe?
-                ENO(new_array = malloc(sizeof(int) * (tmp + 1)));
+    if (!operand_get_value(prog, &args[0], &sleep_duration)) {
+        return;
+    }
 
-                new_array[0] = tmp;
+    dbg_msg(prog, "sleeping value %d", sleep_duration);
 
-                for (int i = 1; i < (tmp + 1); i++)
-                    new_array[i] = 0;
+    if (sleep_duration > 0) {
+        ENO(clock_gettime(CLOCK_MONOTONIC, &prog->wake_time));
 
-                new_array[tmp] = to_set;
-                free(data->ptr);
-                break;
-            }
-            default:
-                return 0;
+        if (ins->code == MSLEEP_SYM) {
+            prog->wake_time.tv_sec += sleep_duration / 1000;
+            prog->wake_time.tv_nsec += (long)(sleep_duration % 1000) * 1000000;
+        } else {
+            prog->wake_time.tv_sec += sleep_duration;
         }
 
-        VDS(QuadHash_insert(prog->vartable, (void*)new_array, (void*)search_key, key_len, NULL, &verr), verr);
+        if (prog->wake_time.tv_nsec >= 1000000000) {
+            prog->wake_time.tv_sec++;
+            prog->wake_time.tv_nsec -= 1000000000;
+        }
 
+        prog->state = SLEEPING;
+    } else {
+        set_error_position(prog);
+        warn_msg(prog, "negative parameter given to %s instruction; nothing will happen",
+                 lexer_instruction_name(ins->code));
     }
-
-    return 1;
 }
 
-int varval_set_value(program_s *prog, token_s *tok, int to_set)
+void print_handler(program_s *prog, const bytecode_s *ins, const operand_s *args)
 {
-    int ret;
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
+    int tmp;
 
-    SET_PARSER_IDX(prog, tok);
-    ret = __varval_set_value(prog, tok->type, &tok->data, tok->len, to_set);
-    RESET_PARSER_IDX(prog);
+    pthread_mutex_lock(&print_lock);
+    printf("%sProgram %d says:%s", TERM_BONW, prog->argv[0], TERM_RESET);
 
-    if (ret) {
-        free(tok);
-    } else {
-        free_token(tok);
-    }
+    printf(" %s ", &img->strs[args[0].val]);
 
-    return ret;
-}
+    for (unsigned int i = 1; i < ins->argc; i++) {
 
-int varval_get_value(program_s *prog, token_s *tok, int *to_get)
-{
-    int ret;
-
-    SET_PARSER_IDX(prog, tok);
-    ret = __varval_get_value(prog, tok->type, &tok->data, tok->len, to_get);
-    RESET_PARSER_IDX(prog);
+        if (!operand_get_value(prog, &args[i], &tmp)) {
+            break;
+        }
 
-    if (ret) {
-        free(tok);
-    } else {
-        free_token(tok);
+        printf("%d ", tmp);
     }
 
-    return ret;
+    putchar('\n');
+
+    pthread_mutex_unlock(&print_lock);
 }
 
-label_data_s *insert_label_to_vartable(program_s *prog, token_s *lbl_tok)
+/* stops the program if any element of a range of cnt elements from start can't exist */
+int check_range(program_s *prog, int start, int cnt, const char *name)
 {
-    vdsErrCode verr;
-    label_data_s *new_label;
-    KeyValuePair *tmp;
+    long long end = (long long)start + cnt - 1;
 
-    ENO(new_label = malloc(sizeof(label_data_s)));
+    if (!check_index(prog, start, name)) {
+        return 0;
+    }
 
-    new_label->placeholder = -1;
-    new_label->offset = lbl_tok->offset;
-    new_label->line = lbl_tok->line;
-    new_label->column = lbl_tok->column;
-    new_label->prev_col = lbl_tok->prev_col;
+    return !cnt || check_index(prog, (end < MAX_INT_ARRAY_LEN) ? (int)end : MAX_INT_ARRAY_LEN, name);
+}
 
-    dbg_msg(prog, "label %s offset = %ld", (char*)lbl_tok->data.ptr, new_label->offset);
-    tmp = QuadHash_insert(prog->vartable, (void*)new_label, (void*)lbl_tok->data.ptr, lbl_tok->len, NULL, &verr);
+/* evaluates the number of elements a vector instruction works on, its last operand */
+int vector_count(program_s *prog, const bytecode_s *ins, const operand_s *args, int *cnt)
+{
+    if (!operand_get_value(prog, &args[ins->argc - 1], cnt)) {
+        return 0;
+    }
 
-    if ((verr == VDS_KEY_EXISTS) && (((label_data_s*)tmp->pData)->offset != new_label->offset)) {
+    if (*cnt < 0 || (!*cnt && (ins->code == VMIN_SYM || ins->code == VMAX_SYM))) {
         program_stop(prog, 1);
-        SET_PARSER_IDX(prog, lbl_tok);
-        err_msg(prog, "can't redefine label with the same name!\n\t%s\n\t^", (char*)lbl_tok->data.ptr);
-        RESET_PARSER_IDX(prog);
-        free(new_label);
-        new_label = NULL;
+        set_error_position(prog);
+        err_msg(prog, "%s instruction expects a%s number of elements; got %d",
+                lexer_instruction_name(ins->code), (*cnt < 0) ? " non negative" : " positive", *cnt);
+        return 0;
     }
 
-    return new_label;
+    return 1;
 }
 
-void exec_instruction_line(program_s *prog)
+/* evaluates the index of the first element of a range of cnt elements of a
+ * local array, and stops the program if any element of the range can't exist */
+int vector_range(program_s *prog, const operand_s *op, int cnt, int *start)
 {
-    token_s *instruction_tok = (token_s*)RingBuffer_read(prog->translated_line, NULL);
+    const operand_s *opnds = ((bytecode_image_s*)prog->image)->opnds;
 
-    if (instruction_tok) {
-        if (instruction_tok->type == LABEL_TOK) {
+    if (!operand_get_value(prog, &opnds[op->idx], start)) {
+        return 0;
+    }
 
-            if (!insert_label_to_vartable(prog, instruction_tok))
-                return;
+    return check_range(prog, *start, cnt, local_name(prog, op->val));
+}
 
-            free(instruction_tok);
-            instruction_tok = (token_s*)RingBuffer_read(prog->translated_line, NULL);
+/* runs a vector instruction over cnt elements of local arrays, whose ranges
+ * were checked, in pieces that are contiguous in all of them. The result is
+ * the same as running the scalar instruction on each element in order, even
+ * if the ranges overlap. Returns acc, folded with the elements of a reduction */
+int vector_ranges(instruction_id_e code, local_var_s *dst_var, int dst_start, local_var_s **src_var,
+                  const int *src_start, unsigned int src_cnt, int val, int cnt, int acc)
+{
+    size_t len, max_len;
+    int *dst = NULL;
+    const int *src[2];
+
+    for (int done = 0; done < cnt; done += (int)len) {
+        max_len = (size_t)(cnt - done);
+
+        /* a source that starts before an overlapping destination can't be read
+         * further than where the destination starts, or it would miss the
+         * elements that are written in this piece */
+        for (unsigned int i = 0; i < src_cnt; i++) {
+            if (src_var[i] == dst_var && src_start[i] < dst_start && dst_start - src_start[i] < cnt &&
+                max_len > (size_t)(dst_start - src_start[i])) {
+                max_len = (size_t)(dst_start - src_start[i]);
+            }
         }
 
-        instruction_id_e code = (instruction_id_e)instruction_tok->data.value;
+        len = max_len;
 
-        free_token(instruction_tok);
+        //element 0 of a local isn't stored with the rest
+        if (dst_var) {
+            size_t idx = (size_t)(dst_start + done);
 
-        ASRT(code <= RETURN_SYM);
-        instruction_array[code].handler(prog, code);
-    } else {
-        prog->state = FINISHED;
-    }
-}
+            if (idx) {
+                dst = int_array_run(&dst_var->arr, idx, &len);
+            } else {
+                dst = &dst_var->val;
+                len = 1;
+            }
+        }
 
-void interpret_next_line(program_s *prog)
-{
-    ASRT(exec_initialized);
+        for (unsigned int i = 0; i < src_cnt; i++) {
+            size_t idx = (size_t)(src_start[i] + done);
+
+            if (idx) {
+                src[i] = int_array_read_run(&src_var[i]->arr, idx, &len);
+            } else {
+                src[i] = &src_var[i]->val;
+                len = 1;
+            }
+        }
 
-    if (prog) {
+        switch (code) {
+            case VADD_SYM:
+            case VSUB_SYM:
+            case VMUL_SYM:
+            {
+                vector_op_e op = (code == VADD_SYM) ? VECTOR_ADD : (code == VSUB_SYM) ? VECTOR_SUB : VECTOR_MUL;
 
-        switch (prog->state) {
-            case MAGIC_LINE:
-                parse_magic(prog);
-                if (prog->state == FINISHED) {
-                    break;
+                if (src_cnt == 2) {
+                    vector_kernels->binary[op](dst, src[0], src[1], len);
+                } else {
+                    vector_kernels->broadcast[op](dst, src[0], val, len);
                 }
-                //fall through to parsing instructions
-                //in case the magic string was matched
-            case INSTRUCTION_LINE:
-                tokenize_next_line(prog);
+                break;
+            }
+            case VFILL_SYM:
+                vector_kernels->fill(dst, val, len);
+                break;
+            case VCOPY_SYM:
+                memmove(dst, src[0], sizeof(int) * len);
+                break;
+            case VSUM_SYM:
+                acc = vector_kernels->reduce[VECTOR_SUM](acc, src[0], len);
+                break;
+            case VMIN_SYM:
+                acc = vector_kernels->reduce[VECTOR_MIN](acc, src[0], len);
+                break;
+            case VMAX_SYM:
+                acc = vector_kernels->reduce[VECTOR_MAX](acc, src[0], len);
                 break;
             default:
                 break;
         }
-
-        if (prog->state == INSTRUCTION_LINE || prog->state == LAST_LINE) {
-            exec_instruction_line(prog);
-            prog->state = (prog->state == LAST_LINE) ? FINISHED : prog->state;
-            //__dbg_print_vartable(prog->vartable);
-        }
     }
+
+    return acc;
 }
-/*
-void __dbg_print_vartable(QuadHashtable *table)
+
+void vector_handler(program_s *prog, const bytecode_s *ins, const operand_s *args)
 {
-    for (unsigned int i = 0; i < table->size; i++) {
+    const operand_s *src_op[2] = {NULL, NULL};
+    local_var_s *dst_var = NULL, *src_var[2] = {NULL, NULL};
+    int cnt, val = 0, acc = 0, dst_start = 0, src_start[2] = {0, 0};
+    unsigned int src_cnt = 0;
 
-        if (table->array[i].state == 1) {
-            printf("[%u] = (key=%s, ", i, (char*)table->array[i].item.pKey);
+    if (!vector_count(prog, ins, args, &cnt)) {
+        return;
+    }
 
-            if (table->array[i].item.pData) {
-                int *arr = (int*)table->array[i].item.pData;
+    switch (ins->code) {
+        case VADD_SYM:
+        case VSUB_SYM:
+        case VMUL_SYM:
+            src_op[src_cnt++] = &args[1];
 
-                printf("data=(");
-                for (int j = 0; j < arr[0] + 1; j++) {
-                    printf("%d,", arr[j]);
-                }
-                printf("\b))");
-            } else {
-                printf("data=(LABEL)");
+            if (args[2].kind == LOCAL_ARR_OPND || args[2].kind == LOCAL_ELEM_OPND) {
+                src_op[src_cnt++] = &args[2];
+            } else if (!operand_get_value(prog, &args[2], &val)) {
+                return;
             }
-        } else {
-            ASRT(table->array[i].state != 2);
-            printf("[%u] = (EMPTY) ", i);
-        }
-
-        putchar('\n');
+            break;
+        case VFILL_SYM:
+            if (!operand_get_value(prog, &args[1], &val)) {
+                return;
+            }
+            break;
+        case VCOPY_SYM:
+            src_op[src_cnt++] = &args[1];
+            break;
+        case VSUM_SYM:
+            src_op[src_cnt++] = &args[1];
+            break;
+        case VMIN_SYM:
+            src_op[src_cnt++] = &args[1];
+            acc = INT_MAX;
+            break;
+        case VMAX_SYM:
+            src_op[src_cnt++] = &args[1];
+            acc = INT_MIN;
+            break;
+        default:
+            return;
     }
-}
-*/
-void load_handler(program_s *prog, instruction_id_e ins_code)
-{
-    (void)ins_code;
-    vdsErrCode verr;
-    token_s *global_tok, *varval_tok;
-    int tmp;
-    char *search_key;
-    size_t idx = 0, key_len;
-
-    VDS(varval_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-    VDS(global_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
 
-    if (global_tok->type == INT_ARR_TOK) {
-        if (!__varval_get_value(prog,
-                                ((int_arr_tok_s*)global_tok->data.ptr)->idx_type,
-                                &((int_arr_tok_s*)global_tok->data.ptr)->idx, 0, &tmp)) {
-            free_token(global_tok);
+    //reductions write a single value, after reading the whole range
+    if (ins->code != VSUM_SYM && ins->code != VMIN_SYM && ins->code != VMAX_SYM) {
+        if (!vector_range(prog, &args[0], cnt, &dst_start)) {
             return;
         }
 
-        idx = tmp;
-        search_key = ((int_arr_tok_s*)global_tok->data.ptr)->name;
-        key_len = strlen(search_key) + 1;
-    } else {
-        search_key = (char*)global_tok->data.ptr;
-        key_len = global_tok->len;
-    }
-
-    global_var_load(search_key, key_len, idx, &tmp);
-
-    if (!varval_set_value(prog, varval_tok, tmp)) {
-        return;
+        dst_var = &prog->locals[args[0].val];
     }
-    free(global_tok);
-}
-
-void store_handler(program_s *prog, instruction_id_e ins_code)
-{
-    (void)ins_code;
-    vdsErrCode verr;
-    token_s *global_tok, *varval_tok;
-    int tmp;
-    char *search_key;
-    size_t idx = 0, key_len;
-
-    VDS(global_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-    VDS(varval_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
 
-    if (global_tok->type == INT_ARR_TOK) {
-        if (!__varval_get_value(prog,
-                                ((int_arr_tok_s*)global_tok->data.ptr)->idx_type,
-                                &((int_arr_tok_s*)global_tok->data.ptr)->idx, 0, &tmp)) {
-            free_token(global_tok);
+    for (unsigned int i = 0; i < src_cnt; i++) {
+        if (!vector_range(prog, src_op[i], cnt, &src_start[i])) {
             return;
         }
 
-        idx = tmp;
-        search_key = ((int_arr_tok_s*)global_tok->data.ptr)->name;
-        key_len = strlen(search_key) + 1;
-    } else {
-        search_key = (char*)global_tok->data.ptr;
-        key_len = global_tok->len;
+        src_var[i] = &prog->locals[src_op[i]->val];
     }
 
-    if (!varval_get_value(prog, varval_tok, &tmp)) {
-        return;
-    }
+    acc = vector_ranges(ins->code, dst_var, dst_start, src_var, src_start, src_cnt, val, cnt, acc);
 
-    global_var_store(search_key, key_len, idx, tmp);
-    free(global_tok);
+    if (ins->code == VSUM_SYM || ins->code == VMIN_SYM || ins->code == VMAX_SYM) {
+        (void)operand_set_value(prog, &args[0], acc);
+    }
 }
 
-void set_handler(program_s *prog, instruction_id_e ins_code)
+/* copies a range of elements between a global array and a local one */
+void transfer_handler(program_s *prog, const bytecode_s *ins, const operand_s *args)
 {
-    (void)ins_code;
-    vdsErrCode verr;
-    token_s *var_tok, *val_tok;
-    int val;
-
-    VDS(var_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-    VDS(val_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-
-    if (!varval_get_value(prog, val_tok, &val)) {
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
+    const operand_s *global_op = &args[(ins->code == LOADN_SYM) ? 1 : 0];
+    const operand_s *local_op = &args[(ins->code == LOADN_SYM) ? 0 : 1];
+    global_var_s *var;
+    size_t idx;
+    int cnt, start;
+
+    if (!vector_count(prog, ins, args, &cnt) || !(var = global_operand(prog, global_op, &idx)) ||
+        !check_range(prog, (int)idx, cnt, &img->strs[img->globals[global_op->val]]) ||
+        !vector_range(prog, local_op, cnt, &start)) {
         return;
     }
 
-    if (!varval_set_value(prog, var_tok, val)) {
-        return;
+    if (ins->code == LOADN_SYM) {
+        global_var_load_range(var, idx, &prog->locals[local_op->val], (size_t)start, (size_t)cnt);
+    } else {
+        global_var_store_range(var, idx, &prog->locals[local_op->val], (size_t)start, (size_t)cnt);
     }
 }
 
-void primitive_op_handler(program_s *prog, instruction_id_e ins_code)
+/* changes an element of a global atomically, and sets the first operand to
+ * the value the element had before. FADD adds to it, SWAP replaces it and CAS
+ * replaces it only if it's equal to the third operand */
+void atomic_handler(program_s *prog, const bytecode_s *ins, const operand_s *args)
 {
-    vdsErrCode verr;
-    token_s *res, *varval1, *varval2;
-    int resval, val1, val2;
-
-    VDS(res = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-    VDS(varval1 = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-    VDS(varval2 = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-
-    if (!varval_get_value(prog, varval1, &val1)) {
-        return;
-    }
+    global_var_s *var;
+    size_t idx;
+    int val1, val2;
 
-    if (!varval_get_value(prog, varval2, &val2)) {
+    if (!(var = global_operand(prog, &args[1], &idx)) || !operand_get_value(prog, &args[2], &val1) ||
+        (ins->code == CAS_SYM && !operand_get_value(prog, &args[3], &val2))) {
         return;
     }
 
-    switch (ins_code) {
-        case ADD_SYM:
-            resval = val1 + val2;
+    switch (ins->code) {
+        case FADD_SYM:
+            val1 = global_var_fetch_add(var, idx, val1);
             break;
-        case SUB_SYM:
-            resval = val1 - val2;
-            break;
-        case MUL_SYM:
-            resval = val1 * val2;
-            break;
-        case DIV_SYM:
-            resval = val1 / val2;
-            break;
-        case MOD_SYM:
-            resval = val1 % val2;
+        case SWAP_SYM:
+            val1 = global_var_swap(var, idx, val1);
             break;
         default:
-            return;
+            val1 = global_var_compare_swap(var, idx, val1, val2);
+            break;
     }
 
-    if (!varval_set_value(prog, res, resval)) {
-        return;
-    }
+    (void)operand_set_value(prog, &args[0], val1);
 }
 
-void branch_handler(program_s *prog, instruction_id_e ins_code)
+/* reads an operand that loop_recognize() found to be the same on every
+ * iteration. Returns 0, instead of stopping the program, if it has no value */
+int loop_value(program_s *prog, const operand_s *op, int *value)
 {
-    vdsErrCode verr;
-    token_s *label, *varval1, *varval2;
-    int jump, val1, val2;
+    const operand_s *opnds = ((bytecode_image_s*)prog->image)->opnds;
 
-    if (ins_code != BRA_SYM) {
-        VDS(varval1 = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-        VDS(varval2 = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
+    if (op->kind == ARGV_OPND) {
+        int idx = opnds[op->idx].val;
 
-        if (!varval_get_value(prog, varval1, &val1)) {
-            return;
+        if (idx < 0 || idx >= prog->argv[1]) {
+            return 0;
         }
 
-        if (!varval_get_value(prog, varval2, &val2)) {
-            return;
-        }
+        *value = prog->argv[idx + 2];
+        return 1;
     }
 
-    VDS(label = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-
-    switch (ins_code) {
-        case BRGT_SYM:
-            jump = ( val1 > val2 );
-            break;
-        case BRGE_SYM:
-            jump = ( val1 >= val2 );
-            break;
-        case BRLT_SYM:
-            jump = ( val1 < val2 );
-            break;
-        case BRLE_SYM:
-            jump = ( val1 <= val2 );
-            break;
-        case BREQ_SYM:
-            jump = ( val1 == val2 );
-            break;
-        case BRA_SYM:
-            jump = 1;
-            break;
-        default:
-            return;
+    if (op->kind == LOCAL_OPND) {
+        *value = prog->locals[op->val].val;
+        return 1;
     }
 
-    if (jump) {
-        KeyValuePair *tmp_pair;
-
-        VDS(tmp_pair = QuadHash_find(prog->vartable, label->data.ptr, label->len, &verr), verr);
-
-        if (tmp_pair) {
-
-            if (*(int*)tmp_pair->pData == -1) {
-                label_data_s *lbl = (label_data_s*)tmp_pair->pData;
-
-                prog->line = lbl->line;
-                prog->column = lbl->column;
-                prog->prev_col = lbl->prev_col;
+    return operand_get_value(prog, op, value);
+}
 
-                prog->c = ' ';
-                ENO(fseek(prog->fd, lbl->offset, SEEK_SET));
-            } else {
-                program_stop(prog, 1);
-                SET_PARSER_IDX(prog, label);
-                err_msg(prog, "branching location name is already defined as a variable\n\t%s\n\t^", label->data.ptr);
-                RESET_PARSER_IDX(prog);
-            }
+/* runs every iteration of a counted loop at once, statement by statement;
+ * each statement only touches the elements of the iteration it's in, and
+ * the accumulators only add up, so the order doesn't change the result.
+ * Returns 0, before running anything, if the interpreter has to run the
+ * loop instead: if a value can't be read, $i would overflow, or an array
+ * index would be out of bounds. The interpreter then reports the error */
+int loop_handler(program_s *prog, const loop_s *loop)
+{
+    local_var_s *regs = prog->locals;
+    long long first = regs[loop->var].val, cnt, end;
+    int bound, vals[LOOP_MAX_STMTS], start[LOOP_MAX_STMTS];
 
-        } else {
-            token_s *tmp_tok, *new_lbl;
+    if (!loop_value(prog, loop->bound, &bound)) {
+        return 0;
+    }
 
-            while (1) {
-                tokenize_next_line(prog);
+    switch (loop->cmp) {
+        case BRLT_SYM: cnt = bound - first; break;
+        case BRLE_SYM: cnt = bound - first + 1; break;
+        case BRGT_SYM: cnt = first - bound; break;
+        default: cnt = first - bound + 1; break;
+    }
 
-                new_lbl = (token_s*)RingBuffer_read(prog->translated_line, &verr);
+    if (cnt < (loop->do_while ? 1 : 0)) {
+        cnt = loop->do_while ? 1 : 0;
+    }
 
-                while (verr != VDS_BUFFER_EMPTY) {
-                    tmp_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr);
-                    free_token(tmp_tok);
-                }
+    end = first + cnt * loop->step;
 
-                if (new_lbl->type == LABEL_TOK) {
+    if (end < INT_MIN || end > INT_MAX) {
+        return 0;
+    }
 
-                    if (!strcmp(new_lbl->data.ptr, label->data.ptr)) {
+    for (unsigned int i = 0; i < loop->stmt_cnt; i++) {
+        const loop_stmt_s *stmt = &loop->stmts[i];
+        long long lo = first + stmt->shift, hi = lo + (cnt - 1) * loop->step;
 
-                        label_data_s *lbl = insert_label_to_vartable(prog, new_lbl);
+        if (loop->step < 0) {
+            long long tmp = lo;
 
-                        if (!lbl) {
-                            free_token(new_lbl);
-                        } else {
-                            prog->line = lbl->line;
-                            prog->column = lbl->column;
-                            prog->prev_col = lbl->prev_col;
+            lo = hi;
+            hi = tmp;
+        }
 
-                            prog->c = ' ';
-                            ENO(fseek(prog->fd, lbl->offset, SEEK_SET));
-                            free(new_lbl);
-                        }
+        start[i] = (int)lo;
 
-                        break;
-                    }
+        switch (stmt->kind) {
+            case LOOP_ACC_VALUE:
+            case LOOP_ELEM_FILL:
+                if (!loop_value(prog, stmt->src[0], &vals[i])) {
+                    return 0;
                 }
-
-                free_token(new_lbl);
-
-                if (prog->state == FINISHED) {
-                    program_stop(prog, 1);
-                    SET_PARSER_IDX(prog, label);
-                    err_msg(prog, "couldn't jump to undefined label\n\t%s\n\t^", label->data.ptr);
-                    RESET_PARSER_IDX(prog);
-                    break;
+                break;
+            case LOOP_ELEM_VALUE:
+                if (!loop_value(prog, stmt->src[1], &vals[i])) {
+                    return 0;
                 }
-            }
-
+                break;
+            default:
+                break;
         }
-    }
-
-    free(label->data.ptr);
-    free(label);
-}
 
-void semaphore_handler(program_s *prog, instruction_id_e ins_code)
-{
-    vdsErrCode verr;
-    token_s *global_tok;
-    int tmp;
-    size_t idx = 0, key_len;
-    char *search_key;
-
-    VDS(global_tok = (token_s*)RingBuffer_read(prog->translated_line, &verr), verr);
-    if (global_tok->type == INT_ARR_TOK) {
-        if (!__varval_get_value(prog,
-                                ((int_arr_tok_s*)global_tok->data.ptr)->idx_type,
-                                &((int_arr_tok_s*)global_tok->data.ptr)->idx, 0, &tmp)) {
-            free_token(global_tok);
-            return;
+        if (stmt->kind != LOOP_ACC_INDEX && stmt->kind != LOOP_ACC_VALUE && cnt &&
+            (lo < 0 || hi >= MAX_INT_ARRAY_LEN)) {
+            return 0;
         }
-        idx = tmp;
-        search_key = ((int_arr_tok_s*)global_tok->data.ptr)->name;
-        key_len = strlen(search_key) + 1;
-    } else {
-        search_key = (char*)global_tok->data.ptr;
-        key_len = global_tok->len;
     }
 
-    switch (ins_code) {
-        case DOWN_SYM:
-            global_var_down(prog, search_key, key_len, idx);
-            break;
-        case UP_SYM:
-            global_var_up(search_key, key_len, idx);
-            break;
-        default:
-            break;
-    }
+    for (unsigned int i = 0; i < loop->stmt_cnt && cnt; i++) {
+        const loop_stmt_s *stmt = &loop->stmts[i];
+        local_var_s *src_var[2];
+        int src_start[2] = {start[i], start[i]};
+        unsigned long long sum = 0, n = (unsigned long long)cnt;
+        instruction_id_e code = (stmt->op == ADD_SYM) ? VADD_SYM : (stmt->op == SUB_SYM) ? VSUB_SYM : VMUL_SYM;
 
-    free(global_tok);
-}
-
-void sleep_handler(program_s *prog, instruction_id_e ins_code)
-{
-    (void)ins_code;
-    token_s *tok;
-    int sleep_duration;
-
-    tok = (token_s*)RingBuffer_read(prog->translated_line, NULL);
-
-    SET_PARSER_IDX(prog, tok);
-
-    if (!__varval_get_value(prog, tok->type, &tok->data, tok->len, &sleep_duration)) {
-        free_token(tok);
-        return;
-    }
-
-    dbg_msg(prog, "sleeping value %d", sleep_duration);
-
-    if (sleep_duration > 0) {
-        prog->state = SLEEPING;
-        prog->sleep_left.tv_sec = (time_t)sleep_duration;
-        prog->sleep_left.tv_nsec = 0;
-    } else {
-        warn_msg(prog, "negative parameter given to SLEEP instruction; nothing will happen");
-    }
-
-    RESET_PARSER_IDX(prog);
-
-    free(tok);
-}
-
-void print_handler(program_s *prog, instruction_id_e ins_code)
-{
-    (void)ins_code;
-    vdsErrCode verr;
-    token_s *tok;
-    int tmp;
-
-    pthread_mutex_lock(&print_lock);
-    printf("%sProgram %d says:%s", TERM_BONW, prog->argv[0], TERM_RESET);
-
-    tok = (token_s*)RingBuffer_read(prog->translated_line, &verr);
-    printf(" %s ", (char*)tok->data.ptr);
-    free_token(tok);
-
-    while (1) {
-        tok = (token_s*)RingBuffer_read(prog->translated_line, &verr);
-
-        if (verr == VDS_BUFFER_EMPTY) {
-            break;
+        if (stmt->src[0] && stmt->src[0]->kind == LOCAL_ARR_OPND) {
+            src_var[0] = &regs[stmt->src[0]->val];
         }
 
-        if (!varval_get_value(prog, tok, &tmp)) {
-            break;
+        if (stmt->src[1] && stmt->src[1]->kind == LOCAL_ARR_OPND) {
+            src_var[1] = &regs[stmt->src[1]->val];
         }
 
-        printf("%d ", tmp);
-    }
+        switch (stmt->kind) {
+            case LOOP_ACC_INDEX:
+                //the sum of an arithmetic sequence, modulo 2^32
+                sum = n * (unsigned long long)(first + stmt->shift) +
+                      (unsigned long long)loop->step * ((n % 2) ? n * ((n - 1) / 2) : (n / 2) * (n - 1));
+                break;
+            case LOOP_ACC_VALUE:
+                sum = n * (unsigned long long)vals[i];
+                break;
+            case LOOP_ACC_ELEM:
+                sum = (unsigned int)vector_ranges(VSUM_SYM, NULL, 0, src_var, src_start, 1, 0, (int)cnt, 0);
+                break;
+            case LOOP_ELEM_BINARY:
+                (void)vector_ranges(code, &regs[stmt->dst], start[i], src_var, src_start, 2, 0, (int)cnt, 0);
+                break;
+            case LOOP_ELEM_VALUE:
+                (void)vector_ranges(code, &regs[stmt->dst], start[i], src_var, src_start, 1, vals[i], (int)cnt, 0);
+                break;
+            case LOOP_ELEM_FILL:
+                (void)vector_ranges(VFILL_SYM, &regs[stmt->dst], start[i], NULL, NULL, 0, vals[i], (int)cnt, 0);
+                break;
+            case LOOP_ELEM_COPY:
+                (void)vector_ranges(VCOPY_SYM, &regs[stmt->dst], start[i], src_var, src_start, 1, 0, (int)cnt, 0);
+                break;
+        }
 
-    putchar('\n');
+        if (stmt->kind == LOOP_ACC_INDEX || stmt->kind == LOOP_ACC_VALUE || stmt->kind == LOOP_ACC_ELEM) {
+            unsigned int acc = (unsigned int)regs[stmt->dst].val;
 
-    pthread_mutex_unlock(&print_lock);
-}
+            acc = (stmt->op == ADD_SYM) ? acc + (unsigned int)sum : acc - (unsigned int)sum;
+            regs[stmt->dst].val = (int)acc;
+        }
+    }
 
-void return_handler(program_s *prog, instruction_id_e ins_code)
-{
-    (void)ins_code;
+    regs[loop->var].val = (int)end;
+    prog->pc = loop->exit;
 
-    prog->state = FINISHED;
+    return 1;
 }
 
 void exec_init(void)
 {
     if (!exec_initialized) {
+        vector_init();
         lexer_init();
         global_table_init();
+        bytecode_cache_init();
         atexit(exec_destroy);
         exec_initialized = 1;
     }
@@ -917,5 +987,6 @@ void exec_init(void)
 void exec_destroy(void)
 {
     lexer_destroy();
+    bytecode_cache_destroy();
     global_table_destroy();
 }
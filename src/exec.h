@@ -5,27 +5,90 @@
 #include "program.h"
 
 
+/* every instruction of the language, along with the scanner handler that
+ * parses its arguments. The instruction_id_e codes and the instruction
+ * table of the scanner are generated from this list */
+#define INSTRUCTION_LIST(X) \
+    X(LOAD, loadstore_handler) \
+    X(STORE, loadstore_handler) \
+    X(SET, set_handler) \
+    X(ADD, primitive_op_handler) \
+    X(SUB, primitive_op_handler) \
+    X(MUL, primitive_op_handler) \
+    X(DIV, primitive_op_handler) \
+    X(MOD, primitive_op_handler) \
+    X(BRGT, branch_handler) \
+    X(BRGE, branch_handler) \
+    X(BRLT, branch_handler) \
+    X(BRLE, branch_handler) \
+    X(BREQ, branch_handler) \
+    X(BRA, branch_handler) \
+    X(DOWN, semaphore_handler) \
+    X(UP, semaphore_handler) \
+    X(SLEEP, sleep_handler) \
+    X(MSLEEP, sleep_handler) \
+    X(PRINT, print_handler) \
+    X(RETURN, return_handler) \
+    X(VADD, vector_handler) \
+    X(VSUB, vector_handler) \
+    X(VMUL, vector_handler) \
+    X(VFILL, vector_handler) \
+    X(VCOPY, vector_handler) \
+    X(VSUM, vector_handler) \
+    X(VMIN, vector_handler) \
+    X(VMAX, vector_handler) \
+    X(LOADN, vector_handler) \
+    X(STOREN, vector_handler) \
+    X(FADD, atomic_handler) \
+    X(SWAP, atomic_handler) \
+    X(CAS, atomic_handler)
+
+/* the arithmetic and conditional branch instructions, along with the C operator they apply */
+#define ARITHMETIC_LIST(X) \
+    X(ADD, +) \
+    X(SUB, -) \
+    X(MUL, *) \
+    X(DIV, /) \
+    X(MOD, %)
+
+#define BRANCH_LIST(X) \
+    X(BRGT, >) \
+    X(BRGE, >=) \
+    X(BRLT, <) \
+    X(BRLE, <=) \
+    X(BREQ, ==)
+
+/* the compiler replaces SET, arithmetic and branch instructions with variants
+ * that are specialized on the shapes of their operands, when it can. In the
+ * suffix of a variant, R is a local variable that's never used as an array
+ * and I is an integer value. Variants can't appear in the source */
+#define ARITHMETIC_VARIANT_ENUM(name, op) name##_RRR_SYM, name##_RRI_SYM, name##_RIR_SYM,
+#define BRANCH_VARIANT_ENUM(name, op) name##_RR_SYM, name##_RI_SYM, name##_IR_SYM,
+#define INSTRUCTION_ENUM(name, handler) name##_SYM,
+
+/* superinstructions replace common sequences of instructions with a single
+ * one, when fusion is enabled for a program. They're only placed on the first
+ * instruction of the sequence, so jumping into the middle of it still works:
+ *   name_RRI_BRA        name_RRI followed by BRA
+ *   INC_name_RR/RI      ADD_RRI followed by the name_RR/RI branch
+ *   name_GLOBAL         LOAD $k $g, name_RRR/RRI $k $k x, STORE $g $k on a
+ *                       scalar global, which is read straight from its cell and
+ *                       written with global_var_store(). Like the instructions
+ *                       it replaces, it isn't atomic: use FADD for that */
+#define FUSED_ARITHMETIC_ENUM(name, op) name##_RRI_BRA_SYM, name##_GLOBAL_SYM,
+#define FUSED_BRANCH_ENUM(name, op) INC_##name##_RR_SYM, INC_##name##_RI_SYM,
+
 typedef enum _instruction_id_e {
-    LOAD_SYM = 0,
-    STORE_SYM,
-    SET_SYM,
-    ADD_SYM,
-    SUB_SYM,
-    MUL_SYM,
-    DIV_SYM,
-    MOD_SYM,
-    BRGT_SYM,
-    BRGE_SYM,
-    BRLT_SYM,
-    BRLE_SYM,
-    BREQ_SYM,
-    BRA_SYM,
-    DOWN_SYM,
-    UP_SYM,
-    SLEEP_SYM,
-    PRINT_SYM,
-    RETURN_SYM //in this enum, RETURN always has to be
-               //defined as the last instruction
+    INSTRUCTION_LIST(INSTRUCTION_ENUM)
+    SET_RR_SYM,
+    SET_RI_SYM,
+    ARITHMETIC_LIST(ARITHMETIC_VARIANT_ENUM)
+    BRANCH_LIST(BRANCH_VARIANT_ENUM)
+    ARITHMETIC_LIST(FUSED_ARITHMETIC_ENUM)
+    BRANCH_LIST(FUSED_BRANCH_ENUM)
+    JIT_ENTER_SYM, //the first instruction of a region that can be compiled to native code
+    LOOP_SYM, //the first instruction of a counted loop that's run by the kernels of its statements
+    INSTRUCTION_CNT
 } instruction_id_e;
 
 typedef void (*i_handler_cb)(program_s *prog, instruction_id_e ins_code);
@@ -36,14 +99,10 @@ typedef struct _instruction_s {
     i_handler_cb handler;
 } instruction_s;
 
-typedef struct _label_data_s {
-    int placeholder;
-    unsigned int line, column, prev_col;
-    long offset;
-} label_data_s;
-
 
-void interpret_next_line(program_s *prog);
+size_t interpret_next_lines(program_s *prog, size_t max_cnt);
+//the scanner owns the table of instruction names
+const char *lexer_instruction_name(instruction_id_e code);
 void exec_init(void);
 
 extern pthread_mutex_t print_lock;
@@ -1,43 +1,72 @@
 #include "global.h"
+#include "runtime.h"
 #include "exec.h"
 #include "program.h"
 #include "scanner.h"
 #include "error.h"
 
 
-static QuadHashtable *global_table;
-static pthread_mutex_t global_table_lock = PTHREAD_MUTEX_INITIALIZER;
+/* a global and its name. Nodes don't change after they're inserted */
+typedef struct _global_node_s {
+    global_var_s *var;
+    uint64_t hash;
+    size_t key_len;
+    char key[];
+} global_node_s;
+
+/* an open addressing table, with linear probing. Slots only go from NULL to
+ * a node, so a table can be searched without a lock. Tables that have been
+ * replaced by a bigger one are kept until the global table is destroyed,
+ * since programs may still be searching them */
+typedef struct _global_table_s {
+    global_node_s **slots;
+    size_t size; //a power of 2
+    struct _global_table_s *prev; //the table that this one replaced
+} global_table_s;
+
+
+static int *global_var_cell(global_var_s *var, size_t idx);
+static void global_var_release(global_var_s *var, size_t idx);
+static int semaphore_take(int *count);
+static wait_queue_s *global_var_queue(global_var_s *var, size_t idx, int create);
+static void global_var_queues_grow(global_var_s *var);
+static void global_var_unlink(global_var_s *var, wait_queue_s *queue, program_s *prev, program_s *prog);
+static void global_var_wake(global_var_s *var, wait_queue_s *queue);
+static uint64_t global_name_hash(const char *key, size_t key_len);
+static global_table_s *global_table_alloc(size_t size);
+static global_node_s *global_table_find(global_table_s *table, const char *key,
+                                        size_t key_len, uint64_t hash, size_t *slot);
+static void global_table_grow(void);
+
+
+static global_table_s *global_table;
+static size_t global_cnt;
+/* inserts hold it for reading, so they only wait for each other when they
+ * race for the same slot, and growing the table holds it for writing */
+static pthread_rwlock_t global_table_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 static int global_initialized = 0;
 
 
-global_var_s *global_var_init(size_t total)
+global_var_s *global_var_init(void)
 {
-    global_var_s *ret = NULL;
-
-    if (total) {
-        pthread_mutexattr_t attr;
-        PTH(pthread_mutexattr_init(&attr));
-        PTH(pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK));
-
-        ENO(ret = malloc(sizeof(global_var_s)));
+    global_var_s *ret;
 
-        ret->len = total;
+    PTH(posix_memalign((void**)&ret, CACHE_LINE_SIZE, sizeof(global_var_s)));
 
 #ifdef INIT_SEMAPHORES_WITH_ONE
-        ENO(ret->count = malloc(total * sizeof(int)));
-        for (size_t i = 0; i < total; i++) {
-            ret->count[i] = 1;
-        }
+    ret->val = 1;
+    int_array_init(&ret->count, 1, NULL);
 #else
-        ENO(ret->count = calloc(total, sizeof(int)));
+    ret->val = 0;
+    int_array_init(&ret->count, 0, NULL);
 #endif
 
-        PTH(pthread_cond_init(&ret->cond, NULL));
-        PTH(pthread_mutex_init(&ret->mtx, &attr));
+    PTH(pthread_mutex_init(&ret->mtx, NULL));
 
-        pthread_mutexattr_destroy(&attr);
-    }
+    ret->queues = NULL;
+    ret->queue_buckets = ret->queue_cnt = 0;
+    ret->waiting = 0;
 
     return ret;
 }
@@ -48,267 +77,497 @@ void global_var_destroy(global_var_s *p)
         global_var_s *arr = (global_var_s*)p;
 
         pthread_mutex_destroy(&arr->mtx);
-        pthread_cond_destroy(&arr->cond);
 
-        free(arr->count);
+        for (size_t i = 0; i < arr->queue_buckets; i++) {
+            while (arr->queues[i]) {
+                wait_queue_s *next = arr->queues[i]->next;
+
+                free(arr->queues[i]);
+                arr->queues[i] = next;
+            }
+        }
+        free(arr->queues);
+
+        int_array_destroy(&arr->count);
         free(arr);
     }
 }
 
-void global_var_up(char *key, size_t key_len, size_t idx)
+//FNV-1a
+uint64_t global_name_hash(const char *key, size_t key_len)
 {
-    ASRT(global_initialized);
-
-    vdsErrCode verr;
-    KeyValuePair *pair;
-    global_var_s *var;
+    uint64_t hash = 14695981039346656037ULL;
 
-    PTH(pthread_mutex_lock(&global_table_lock));
+    for (size_t i = 0; i < key_len; i++) {
+        hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+    }
 
-    pair = QuadHash_find(global_table, key, key_len, &verr);
+    return hash;
+}
 
-    if (pair) {
-        PTH(pthread_mutex_unlock(&global_table_lock));
-        free(key);
+global_table_s *global_table_alloc(size_t size)
+{
+    global_table_s *ret;
 
-        var = (global_var_s*)pair->pData;
+    ENO(ret = malloc(sizeof(global_table_s)));
+    ENO(ret->slots = calloc(size, sizeof(global_node_s*)));
 
-        PTH(pthread_mutex_lock(&var->mtx));
-        if (idx < var->len) {
+    ret->size = size;
+    ret->prev = NULL;
 
-            var->count[idx]++;
-            PTH(pthread_cond_broadcast(&var->cond));
+    return ret;
+}
 
-        } else {
+/* returns the node of a name in a table, or NULL if it isn't there, with *slot
+ * set to the empty slot where it would be inserted */
+global_node_s *global_table_find(global_table_s *table, const char *key,
+                                 size_t key_len, uint64_t hash, size_t *slot)
+{
+    size_t mask = table->size - 1;
 
-            ENO(var->count = realloc(var, sizeof(int) * (idx + 1)));
+    for (size_t i = hash & mask, cnt = 0; cnt < table->size; i = (i + 1) & mask, cnt++) {
+        global_node_s *node = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
 
-#ifdef INIT_SEMAPHORES_WITH_ONE
-            for (size_t i = var->len; i < idx; i++) {
-                var->count[i] = 1;
-            }
+        if (!node) {
+            *slot = i;
+            return NULL;
+        }
 
-            var->count[idx] = 2;
-#else
-            for (size_t i = var->len; i < idx; i++) {
-                var->count[i] = 0;
-            }
+        if (node->hash == hash && node->key_len == key_len && !memcmp(node->key, key, key_len)) {
+            return node;
+        }
+    }
 
-            var->count[idx] = 1;
-#endif
-            var->len = idx + 1;
+    //the table is grown long before it's full
+    ASRT(0);
+    return NULL;
+}
 
-        }
-        PTH(pthread_mutex_unlock(&var->mtx));
+/* doubles the size of the table, if it's more than half full */
+void global_table_grow(void)
+{
+    PTH(pthread_rwlock_wrlock(&global_table_lock));
 
-    } else {
+    global_table_s *table = global_table;
 
-        var = global_var_init(idx + 1);
-        var->count[idx] = 1;
+    if (global_cnt > table->size / 2) {
+        global_table_s *bigger = global_table_alloc(table->size * 2);
 
-        VDS(QuadHash_insert(global_table, var, key, key_len, NULL, &verr), verr);
+        for (size_t i = 0; i < table->size; i++) {
+            global_node_s *node = table->slots[i];
+            size_t slot;
 
-        PTH(pthread_mutex_unlock(&global_table_lock));
+            if (node) {
+                (void)global_table_find(bigger, node->key, node->key_len, node->hash, &slot);
+                bigger->slots[slot] = node;
+            }
+        }
 
+        bigger->prev = table;
+        __atomic_store_n(&global_table, bigger, __ATOMIC_RELEASE);
     }
+
+    PTH(pthread_rwlock_unlock(&global_table_lock));
 }
 
-void global_var_down(program_s *prog, char *key, size_t key_len, size_t idx)
+/* returns the global with the given name, creating it if it doesn't exist.
+ * This is the only place where the global table is accessed after
+ * initialization; the returned handle stays valid until the table is destroyed */
+global_var_s *global_var_bind(const char *key, size_t key_len)
 {
     ASRT(global_initialized);
 
-    vdsErrCode verr;
-    KeyValuePair *pair;
-    global_var_s *var;
+    uint64_t hash = global_name_hash(key, key_len);
+    global_node_s *node, *found;
+    global_table_s *table;
+    size_t slot;
+    int grow = 0;
 
-    PTH(pthread_mutex_lock(&global_table_lock));
+    //most of the globals of an image were created by an image that was loaded before it
+    if ((node = global_table_find(__atomic_load_n(&global_table, __ATOMIC_ACQUIRE), key, key_len, hash, &slot))) {
+        return node->var;
+    }
 
-    pair = QuadHash_find(global_table, key, key_len, &verr);
+    ENO(node = malloc(sizeof(global_node_s) + key_len));
+    node->var = global_var_init();
+    node->hash = hash;
+    node->key_len = key_len;
+    memcpy(node->key, key, key_len);
 
-    if (pair) {
-        PTH(pthread_mutex_unlock(&global_table_lock));
-        free(key);
+    PTH(pthread_rwlock_rdlock(&global_table_lock));
 
-        var = (global_var_s*)pair->pData;
+    //the table can't be replaced while the lock is held
+    table = global_table;
 
+    while (!(found = global_table_find(table, key, key_len, hash, &slot))) {
+        global_node_s *expected = NULL;
 
-        PTH(pthread_mutex_lock(&var->mtx));
-        if (idx >= var->len) {
-            ENO(var->count = realloc(var, sizeof(int) * (idx + 1)));
+        if (__atomic_compare_exchange_n(&table->slots[slot], &expected, node, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            grow = __atomic_add_fetch(&global_cnt, 1, __ATOMIC_RELAXED) > table->size / 2;
+            found = node;
+            node = NULL;
+            break;
+        }
 
-            for (size_t i = var->len; i < idx; i++) {
-#ifdef INIT_SEMAPHORES_WITH_ONE
-                var->count[i] = 1;
-#else
-                var->count[i] = 0;
-#endif
-            }
+        //another program inserted a name in the slot first; it may be this one
+    }
 
-            var->len = idx + 1;
+    PTH(pthread_rwlock_unlock(&global_table_lock));
+
+    //the name was inserted by another program while this one wasn't holding the lock
+    if (node) {
+        global_var_destroy(node->var);
+        free(node);
+    }
+
+    if (grow) {
+        global_table_grow();
+    }
+
+    return found->var;
+}
+
+/* returns an element of a global. The other elements are in pages that can be
+ * allocated at any time, so the lock of the global is held until the element
+ * is released; element 0 doesn't need it */
+int *global_var_cell(global_var_s *var, size_t idx)
+{
+    if (!idx) {
+        return &var->val;
+    }
+
+    PTH(pthread_mutex_lock(&var->mtx));
+
+    return int_array_elem(&var->count, idx);
+}
+
+/* releases an element after it was written, which may let the programs that
+ * are blocked on the global go on. Element 0 is written with sequentially
+ * consistent operations, like the count of waiters, so either the writer
+ * sees a program that blocked or the program sees the new value */
+void global_var_release(global_var_s *var, size_t idx)
+{
+    if (!idx) {
+        if (!__atomic_load_n(&var->waiting, __ATOMIC_SEQ_CST)) {
+            return;
         }
 
-        PTH(pthread_mutex_unlock(&var->mtx));
-    } else {
-        var = global_var_init(idx + 1);
+        PTH(pthread_mutex_lock(&var->mtx));
+    }
 
-        VDS(QuadHash_insert(global_table, var, key, key_len, NULL, &verr), verr);
+    wait_queue_s *queue = global_var_queue(var, idx, 0);
 
-        PTH(pthread_mutex_unlock(&global_table_lock));
+    if (queue) {
+        global_var_wake(var, queue);
     }
 
-    prog->blocked_idx = idx;
-    prog->state = BLOCKED;
-    prog->sem = (void*)var;
+    PTH(pthread_mutex_unlock(&var->mtx));
 }
 
-/* Should be called __only__ when the program is in BLOCKED state */
-void program_state_blocked(program_s *prog, long sleep_nsec)
+/* decrements the count of a semaphore if it's positive. Returns 0 if it isn't */
+int semaphore_take(int *count)
 {
-    struct timespec sleeping_time = {.tv_sec = 0, .tv_nsec = sleep_nsec};
-    global_var_s *var = (global_var_s*)prog->sem;
+    int curr = __atomic_load_n(count, __ATOMIC_SEQ_CST);
 
-    PTH(pthread_mutex_lock(&var->mtx));
-    if (var->count[prog->blocked_idx] <= 0) {
+    while (curr > 0) {
+        if (__atomic_compare_exchange_n(count, &curr, curr - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
 
-        /*ret = */pthread_cond_timedwait(&var->cond, &var->mtx, &sleeping_time);
+    return 0;
+}
 
-        if (var->count[prog->blocked_idx] > 0) {
-            var->count[prog->blocked_idx]--;
+/* returns the wait queue of an element of a global, or NULL if no program
+ * ever blocked on it and create is 0. The lock of the global has to be held */
+wait_queue_s *global_var_queue(global_var_s *var, size_t idx, int create)
+{
+    wait_queue_s *queue;
 
-            if (prog->state == BLOCKED) {
-                prog->state = INSTRUCTION_LINE;
+    if (var->queue_buckets) {
+        for (queue = var->queues[idx & (var->queue_buckets - 1)]; queue; queue = queue->next) {
+            if (queue->idx == idx) {
+                return queue;
             }
         }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (var->queue_cnt >= var->queue_buckets) {
+        global_var_queues_grow(var);
+    }
+
+    ENO(queue = malloc(sizeof(wait_queue_s)));
+    queue->idx = idx;
+    queue->first = queue->last = NULL;
+    queue->next = var->queues[idx & (var->queue_buckets - 1)];
+    var->queues[idx & (var->queue_buckets - 1)] = queue;
+    var->queue_cnt++;
+
+    return queue;
+}
+
+//doubles the buckets of the wait queues of a global
+void global_var_queues_grow(global_var_s *var)
+{
+    size_t buckets = var->queue_buckets ? var->queue_buckets * 2 : WAIT_QUEUE_INIT_BUCKETS;
+    wait_queue_s **queues;
+
+    ENO(queues = calloc(buckets, sizeof(wait_queue_s*)));
+
+    for (size_t i = 0; i < var->queue_buckets; i++) {
+        while (var->queues[i]) {
+            wait_queue_s *queue = var->queues[i];
+
+            var->queues[i] = queue->next;
+            queue->next = queues[queue->idx & (buckets - 1)];
+            queues[queue->idx & (buckets - 1)] = queue;
+        }
+    }
+
+    free(var->queues);
+    var->queues = queues;
+    var->queue_buckets = buckets;
+}
 
+//removes a program from a wait queue of a global, with prev being the one before it
+void global_var_unlink(global_var_s *var, wait_queue_s *queue, program_s *prev, program_s *prog)
+{
+    if (prev) {
+        prev->next_waiter = prog->next_waiter;
     } else {
-        var->count[prog->blocked_idx]--;
-        if (prog->state == BLOCKED) {
-            prog->state = INSTRUCTION_LINE;
+        queue->first = prog->next_waiter;
+    }
+
+    if (queue->last == prog) {
+        queue->last = prev;
+    }
+
+    prog->next_waiter = NULL;
+    __atomic_sub_fetch(&var->waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+/* makes runnable the programs of a wait queue that can now take the
+ * semaphore, in the order they were queued, stopping at the first one that
+ * can't. The lock of the global has to be held, and it's held until the
+ * programs are woken, so that they can't be freed in the meantime */
+void global_var_wake(global_var_s *var, wait_queue_s *queue)
+{
+    int *count = queue->idx ? int_array_elem(&var->count, queue->idx) : &var->val;
+    program_s *prog;
+
+    while ((prog = queue->first) && semaphore_take(count)) {
+        global_var_unlink(var, queue, NULL, prog);
+
+        //a program that was killed while it was blocked gives the semaphore back
+        if (!runtime_wake_program(prog)) {
+            __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
         }
     }
-    PTH(pthread_mutex_unlock(&var->mtx));
 }
 
-void global_vartable_free_cb(void *p)
+void global_var_up(global_var_s *var, size_t idx)
 {
-    KeyValuePair *param = (KeyValuePair*)p;
+    __atomic_fetch_add(global_var_cell(var, idx), 1, __ATOMIC_SEQ_CST);
 
-    free(param->pKey);
-    global_var_destroy((global_var_s*)param->pData);
+    global_var_release(var, idx);
 }
 
-void global_var_load(char *key, size_t key_len, size_t idx, int *val)
+/* takes the semaphore if it's positive; if it isn't, the program is blocked,
+ * and queued on the element until a program raises it */
+void global_var_down(program_s *prog, global_var_s *var, size_t idx)
 {
-    ASRT(global_initialized);
+    int *count;
 
-    vdsErrCode verr;
-    KeyValuePair *pair;
-    global_var_s *var;
+    if (!idx && semaphore_take(&var->val)) {
+        return;
+    }
 
-    PTH(pthread_mutex_lock(&global_table_lock));
+    PTH(pthread_mutex_lock(&var->mtx));
 
-    pair = QuadHash_find(global_table, key, key_len, &verr);
+    count = idx ? int_array_elem(&var->count, idx) : &var->val;
 
-    if (pair) {
-        PTH(pthread_mutex_unlock(&global_table_lock));
-        free(key);
+    //the program counts as waiting before it looks at the semaphore for the last time
+    __atomic_add_fetch(&var->waiting, 1, __ATOMIC_SEQ_CST);
 
-        var = (global_var_s*)pair->pData;
+    if (semaphore_take(count)) {
+        __atomic_sub_fetch(&var->waiting, 1, __ATOMIC_SEQ_CST);
+    } else {
+        prog->blocked_idx = idx;
+        prog->sem = (void*)var;
+        prog->next_waiter = NULL;
+        prog->state = BLOCKED;
 
-        PTH(pthread_mutex_lock(&var->mtx));
-        if (idx < var->len) {
-            if (val) {
-                *val = var->count[idx];
-            }
+        wait_queue_s *queue = global_var_queue(var, idx, 1);
+
+        if (queue->last) {
+            queue->last->next_waiter = prog;
         } else {
+            queue->first = prog;
+        }
 
-            ENO(var->count = realloc(var, sizeof(int) * (idx + 1)));
+        queue->last = prog;
+    }
 
-            for (size_t i = var->len; i < idx + 1; i++) {
-#ifdef INIT_SEMAPHORES_WITH_ONE
-                var->count[i] = 1;
-#else
-                var->count[i] = 0;
-#endif
-            }
+    PTH(pthread_mutex_unlock(&var->mtx));
+}
+
+/* takes a program off the queue of the global it blocked on, if it's still
+ * there, so that it can be freed. If the program was woken but never ran
+ * again, the semaphore that was taken for it is given back */
+void global_var_cancel(program_s *prog)
+{
+    global_var_s *var = (global_var_s*)prog->sem;
 
-            var->len = idx + 1;
+    if (var) {
+        program_s *prev = NULL;
+        int give_back;
 
-            if (val)
-                *val = 0;
+        PTH(pthread_mutex_lock(&var->mtx));
+
+        wait_queue_s *queue = global_var_queue(var, prog->blocked_idx, 0);
+
+        for (program_s *curr = queue ? queue->first : NULL; curr; prev = curr, curr = curr->next_waiter) {
+            if (curr == prog) {
+                global_var_unlink(var, queue, prev, prog);
+                break;
+            }
         }
+
+        //it's set under the lock of the global, by the program that woke this one
+        give_back = prog->sem_taken;
+        prog->sem_taken = 0;
+
         PTH(pthread_mutex_unlock(&var->mtx));
 
-    } else {
+        if (give_back) {
+            global_var_up(var, prog->blocked_idx);
+        }
+    }
+}
 
-        VDS(QuadHash_insert(global_table, global_var_init(idx + 1), key, key_len, NULL, &verr), verr);
+/* element 0 is read and written without the lock. Its loads acquire, and
+ * its stores are sequentially consistent, so a program that sees a value a
+ * STORE wrote also sees everything the other program wrote before it */
+void global_var_load(global_var_s *var, size_t idx, int *val)
+{
+    int ret;
 
-        PTH(pthread_mutex_unlock(&global_table_lock));
+    if (!idx) {
+        ret = __atomic_load_n(&var->val, __ATOMIC_ACQUIRE);
+    } else {
+        PTH(pthread_mutex_lock(&var->mtx));
+        ret = int_array_get(&var->count, idx);
+        PTH(pthread_mutex_unlock(&var->mtx));
+    }
 
-        if (val)
-            *val = 0;
+    if (val) {
+        *val = ret;
     }
 }
 
-void global_var_store(char *key, size_t key_len, size_t idx, int to_store)
+void global_var_store(global_var_s *var, size_t idx, int to_store)
 {
-    ASRT(global_initialized);
+    __atomic_store_n(global_var_cell(var, idx), to_store, __ATOMIC_SEQ_CST);
 
-    vdsErrCode verr;
-    KeyValuePair *pair;
-    global_var_s *var;
+    global_var_release(var, idx);
+}
 
-    PTH(pthread_mutex_lock(&global_table_lock));
+/* the atomic instructions. Each returns the value the element had before it was changed */
+int global_var_fetch_add(global_var_s *var, size_t idx, int val)
+{
+    int ret = __atomic_fetch_add(global_var_cell(var, idx), val, __ATOMIC_SEQ_CST);
 
-    pair = QuadHash_find(global_table, key, key_len, &verr);
+    global_var_release(var, idx);
 
-    if (pair) {
-        PTH(pthread_mutex_unlock(&global_table_lock));
-        free(key);
+    return ret;
+}
 
-        var = (global_var_s*)pair->pData;
+int global_var_swap(global_var_s *var, size_t idx, int val)
+{
+    int ret = __atomic_exchange_n(global_var_cell(var, idx), val, __ATOMIC_SEQ_CST);
 
-        PTH(pthread_mutex_lock(&var->mtx));
-        if (idx < var->len) {
+    global_var_release(var, idx);
 
-            var->count[idx] = to_store;
+    return ret;
+}
 
-        } else {
+int global_var_compare_swap(global_var_s *var, size_t idx, int expected, int val)
+{
+    (void)__atomic_compare_exchange_n(global_var_cell(var, idx), &expected, val, 0,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
 
-            ENO(var->count = realloc(var, sizeof(int) * (idx + 1)));
+    global_var_release(var, idx);
 
-            for (size_t i = var->len; i < idx + 1; i++) {
-#ifdef INIT_SEMAPHORES_WITH_ONE
-                var->count[i] = 1;
-#else
-                var->count[i] = 0;
-#endif
-            }
+    //on failure, expected is set to the value of the element
+    return expected;
+}
 
-            var->count[idx] = to_store;
-            var->len = idx + 1;
+/* copies cnt elements of a global, starting from idx, to the elements of a
+ * local starting from local_idx. The whole range is copied while holding the
+ * lock of the global once, so no other LOADN or STOREN sees it half updated.
+ * Element 0 is accessed without the lock by the other instructions, so a
+ * LOAD, STORE or FADD on it can still happen in the middle of a range. It's
+ * read and written with the same ordering they use */
+void global_var_load_range(global_var_s *var, size_t idx, local_var_s *local, size_t local_idx, size_t cnt)
+{
+    PTH(pthread_mutex_lock(&var->mtx));
+
+    //element 0 of a global or of a local isn't stored with the rest
+    for (; cnt && (!idx || !local_idx); idx++, local_idx++, cnt--) {
+        int val = idx ? int_array_get(&var->count, idx) : __atomic_load_n(&var->val, __ATOMIC_ACQUIRE);
+
+        if (local_idx) {
+            *int_array_elem(&local->arr, local_idx) = val;
+        } else {
+            local->val = val;
         }
-        PTH(pthread_mutex_unlock(&var->mtx));
+    }
 
-    } else {
+    int_array_copy(&local->arr, local_idx, &var->count, idx, cnt);
+
+    PTH(pthread_mutex_unlock(&var->mtx));
+}
 
-        var = global_var_init(idx + 1);
-        var->count[idx] = to_store;
+void global_var_store_range(global_var_s *var, size_t idx, local_var_s *local, size_t local_idx, size_t cnt)
+{
+    size_t start = idx, len = cnt;
 
-        VDS(QuadHash_insert(global_table, var, key, key_len, NULL, &verr), verr);
+    PTH(pthread_mutex_lock(&var->mtx));
+
+    for (; cnt && (!idx || !local_idx); idx++, local_idx++, cnt--) {
+        int val = local_idx ? int_array_get(&local->arr, local_idx) : local->val;
+
+        if (idx) {
+            *int_array_elem(&var->count, idx) = val;
+        } else {
+            __atomic_store_n(&var->val, val, __ATOMIC_SEQ_CST);
+        }
+    }
 
-        PTH(pthread_mutex_unlock(&global_table_lock));
+    int_array_copy(&var->count, idx, &local->arr, local_idx, cnt);
 
+    //only the queues of the elements that were written are woken
+    for (size_t i = 0; i < var->queue_buckets; i++) {
+        for (wait_queue_s *queue = var->queues[i]; queue; queue = queue->next) {
+            if (queue->idx >= start && queue->idx - start < len) {
+                global_var_wake(var, queue);
+            }
+        }
     }
 
+    PTH(pthread_mutex_unlock(&var->mtx));
 }
 
 void global_table_init(void)
 {
     if (!global_initialized) {
-        vdsErrCode verr;
-
-        VDS(global_table = QuadHash_init(GLOBAL_TABLE_INIT_SIZE, symbol_name_cmp, NULL, &verr), verr);
+        global_table = global_table_alloc(GLOBAL_TABLE_INIT_SIZE);
+        global_cnt = 0;
 
         global_initialized = 1;
 
@@ -318,7 +577,24 @@ void global_table_init(void)
 
 void global_table_destroy(void)
 {
-    if (global_initialized) {
-        QuadHash_destroy(&global_table, global_vartable_free_cb, NULL);
+    if (global_initialized && global_table) {
+        global_table_s *table = global_table;
+
+        for (size_t i = 0; i < table->size; i++) {
+            if (table->slots[i]) {
+                global_var_destroy(table->slots[i]->var);
+                free(table->slots[i]);
+            }
+        }
+
+        while (table) {
+            global_table_s *prev = table->prev;
+
+            free(table->slots);
+            free(table);
+            table = prev;
+        }
+
+        global_table = NULL;
     }
 }
@@ -3,25 +3,49 @@
 
 #include "common.h"
 #include "program.h"
-
+#include "array.h"
+
+/* the programs blocked on one element of a global, in the order they blocked */
+typedef struct _wait_queue_s {
+    size_t idx;
+    program_s *first, *last;
+    struct _wait_queue_s *next; //the next queue in the same bucket
+} wait_queue_s;
+
+/* element 0 of a global, the one that's used when it isn't indexed, has a
+ * cell of its own that's only accessed with atomic operations, so that it can
+ * be read and written without taking the lock of the global. The cell has a
+ * cache line to itself, so it isn't invalidated by the programs that lock
+ * the global for its semaphores or its other elements */
 typedef struct _global_var_s {
-    int *count;
-    size_t len;
+    int val;
+    char pad[CACHE_LINE_SIZE - sizeof(int)];
+    int_array_s count; //the rest of the elements
     pthread_mutex_t mtx;
-    pthread_cond_t cond;
+    //the wait queues of the elements that programs blocked on, hashed by index.
+    //Queues are kept when they're emptied, since the same elements are waited on again
+    wait_queue_s **queues;
+    size_t queue_buckets, queue_cnt;
+    int waiting; //the number of programs in the queues; read without the lock, by the programs that write the global
 } global_var_s;
 
 
-global_var_s *global_var_init(size_t total);
+global_var_s *global_var_init(void);
 void global_var_destroy(global_var_s *p);
 
-void global_var_up(char *key, size_t key_len, size_t idx);
-void global_var_down(program_s *prog, char *key, size_t key_len, size_t idx);
+global_var_s *global_var_bind(const char *key, size_t key_len);
 
-void program_state_blocked(program_s *prog, long sleep_nsec);
+void global_var_up(global_var_s *var, size_t idx);
+void global_var_down(program_s *prog, global_var_s *var, size_t idx);
+void global_var_cancel(program_s *prog);
 
-void global_var_load(char *key, size_t key_len, size_t idx, int *val);
-void global_var_store(char *key, size_t key_len, size_t idx, int to_store);
+void global_var_load(global_var_s *var, size_t idx, int *val);
+void global_var_store(global_var_s *var, size_t idx, int to_store);
+int global_var_fetch_add(global_var_s *var, size_t idx, int val);
+int global_var_swap(global_var_s *var, size_t idx, int val);
+int global_var_compare_swap(global_var_s *var, size_t idx, int expected, int val);
+void global_var_load_range(global_var_s *var, size_t idx, local_var_s *local, size_t local_idx, size_t cnt);
+void global_var_store_range(global_var_s *var, size_t idx, local_var_s *local, size_t local_idx, size_t cnt);
 
 void global_table_init(void);
 void global_table_destroy(void);
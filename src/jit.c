@@ -0,0 +1,613 @@
+#include "jit.h"
+#include "error.h"
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* native code is only generated for x86-64. On other machines regions
+ * never get compiled, and their instructions are always interpreted */
+#if defined(__x86_64__)
+# define SIMBLY_JIT_X86_64
+#endif
+
+//upper bounds of the native code of an instruction and of the code around the body
+#define JIT_INS_MAX_BYTES 96
+#define JIT_FRAME_MAX_BYTES 256
+
+typedef enum _jit_loc_kind_e {
+    IMM_LOC,    //val is the integer value
+    REG_LOC,    //val is the machine register the local lives in
+    LOCAL_LOC,  //val is the offset of the local from the register file
+    ARGV_LOC    //val is the offset of the argument from argv
+} jit_loc_kind_e;
+
+/* where an operand lives in the native code */
+typedef struct _jit_loc_s {
+    jit_loc_kind_e kind;
+    int val;
+} jit_loc_s;
+
+/* a rel32 field of a jump that's patched once its target is emitted */
+typedef struct _jit_fixup_s {
+    size_t pos, target;
+    int is_exit; //if set, the jump leaves the region with pc = target
+} jit_fixup_s;
+
+typedef struct _jit_buf_s {
+    unsigned char *p;
+    size_t len;
+    jit_fixup_s *fixups;
+    size_t fixup_cnt;
+} jit_buf_s;
+
+typedef enum _x86_reg_e {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+} x86_reg_e;
+
+//condition codes of jcc
+#define CC_E  0x4
+#define CC_L  0xc
+#define CC_GE 0xd
+#define CC_LE 0xe
+#define CC_G  0xf
+#define CC_INVERT(cc) ((cc) ^ 1)
+
+/* the registers locals can be kept in. rdi holds the register file, rsi argv,
+ * r8 the address of pc, r9 the budget and rax, rcx, rdx are scratch */
+static const x86_reg_e alloc_regs[] = {RBX, R12, R13, R14, R15, R10, R11};
+
+
+static int jit_operand(program_s *prog, jit_s *jit, const operand_s *op, jit_loc_s *loc);
+static int jittable(program_s *prog, jit_s *jit, size_t pos);
+static int jit_compile_region(program_s *prog, jit_s *jit, jit_region_s *region);
+
+#ifdef SIMBLY_JIT_X86_64
+static void emit_byte(jit_buf_s *b, unsigned char c);
+static void emit_u32(jit_buf_s *b, uint32_t v);
+static void emit_rex(jit_buf_s *b, int w, int reg, int rm);
+static void emit_modrm(jit_buf_s *b, int mod, int reg, int rm);
+static void emit_load(jit_buf_s *b, x86_reg_e dst, const jit_loc_s *loc);
+static void emit_store(jit_buf_s *b, const jit_loc_s *loc, x86_reg_e src);
+static void emit_jump(jit_buf_s *b, int cc, size_t target, int is_exit);
+static void emit_instruction(jit_buf_s *b, program_s *prog, jit_s *jit,
+                             const int *reg_of, size_t pos, size_t head, size_t end);
+#endif
+
+
+
+
+/* finds where an operand lives in the native code. Returns 0 if it can't
+ * be used there, e.g. if it's an array element or argv with a variable index */
+int jit_operand(program_s *prog, jit_s *jit, const operand_s *op, jit_loc_s *loc)
+{
+    const operand_s *opnds = ((bytecode_image_s*)prog->image)->opnds;
+
+    switch (op->kind) {
+        case IMM_OPND:
+            loc->kind = IMM_LOC;
+            loc->val = op->val;
+            return 1;
+        case LOCAL_OPND:
+            if (jit->is_array[op->val]) {
+                return 0;
+            }
+
+            loc->kind = LOCAL_LOC;
+            loc->val = op->val * (int)sizeof(local_var_s) + (int)offsetof(local_var_s, val);
+            return 1;
+        case ARGC_OPND:
+            loc->kind = ARGV_LOC;
+            loc->val = (int)sizeof(int);
+            return 1;
+        case ARGV_OPND:
+            //the arguments of a program never change, so a constant index is checked once
+            if (opnds[op->idx].kind != IMM_OPND ||
+                opnds[op->idx].val < 0 || opnds[op->idx].val >= prog->argv[1]) {
+                return 0;
+            }
+
+            loc->kind = ARGV_LOC;
+            loc->val = (opnds[op->idx].val + 2) * (int)sizeof(int);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* whether the instruction in position pos can be part of a region */
+int jittable(program_s *prog, jit_s *jit, size_t pos)
+{
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
+    const bytecode_s *ins = &img->code[pos];
+    const operand_s *args = &img->opnds[ins->args];
+    jit_loc_s loc;
+    unsigned int opnd_cnt;
+
+    //loops that have kernels are faster in the interpreter
+    if (jit->orig[pos].code == LOOP_SYM) {
+        return 0;
+    }
+
+    switch (bytecode_base_code(ins->code)) {
+        case SET_SYM:
+            opnd_cnt = 2;
+            break;
+        case ADD_SYM:
+        case SUB_SYM:
+        case MUL_SYM:
+        case DIV_SYM:
+        case MOD_SYM:
+            opnd_cnt = 3;
+            break;
+        case BRGT_SYM:
+        case BRGE_SYM:
+        case BRLT_SYM:
+        case BRLE_SYM:
+        case BREQ_SYM:
+            opnd_cnt = 2;
+            break;
+        case BRA_SYM:
+            return 1;
+        default:
+            return 0;
+    }
+
+    for (unsigned int i = 0; i < opnd_cnt; i++) {
+        if (!jit_operand(prog, jit, &args[i], &loc)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#ifdef SIMBLY_JIT_X86_64
+
+void emit_byte(jit_buf_s *b, unsigned char c)
+{
+    b->p[b->len++] = c;
+}
+
+void emit_u32(jit_buf_s *b, uint32_t v)
+{
+    memcpy(b->p + b->len, &v, sizeof(v));
+    b->len += sizeof(v);
+}
+
+void emit_rex(jit_buf_s *b, int w, int reg, int rm)
+{
+    unsigned char rex = 0x40 | (w << 3) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+
+    if (rex != 0x40) {
+        emit_byte(b, rex);
+    }
+}
+
+void emit_modrm(jit_buf_s *b, int mod, int reg, int rm)
+{
+    emit_byte(b, (unsigned char)((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+}
+
+/* mov dst32, operand */
+void emit_load(jit_buf_s *b, x86_reg_e dst, const jit_loc_s *loc)
+{
+    switch (loc->kind) {
+        case IMM_LOC:
+            emit_rex(b, 0, 0, dst);
+            emit_byte(b, 0xb8 + (dst & 7));
+            emit_u32(b, (uint32_t)loc->val);
+            break;
+        case REG_LOC:
+            if ((x86_reg_e)loc->val != dst) {
+                emit_rex(b, 0, loc->val, dst);
+                emit_byte(b, 0x89);
+                emit_modrm(b, 3, loc->val, dst);
+            }
+            break;
+        case LOCAL_LOC:
+        case ARGV_LOC:
+            emit_rex(b, 0, dst, (loc->kind == LOCAL_LOC) ? RDI : RSI);
+            emit_byte(b, 0x8b);
+            emit_modrm(b, 2, dst, (loc->kind == LOCAL_LOC) ? RDI : RSI);
+            emit_u32(b, (uint32_t)loc->val);
+            break;
+    }
+}
+
+/* mov operand, src32. Only locals are ever written */
+void emit_store(jit_buf_s *b, const jit_loc_s *loc, x86_reg_e src)
+{
+    if (loc->kind == REG_LOC) {
+        if ((x86_reg_e)loc->val != src) {
+            emit_rex(b, 0, src, loc->val);
+            emit_byte(b, 0x89);
+            emit_modrm(b, 3, src, loc->val);
+        }
+    } else {
+        ASRT(loc->kind == LOCAL_LOC);
+        emit_rex(b, 0, src, RDI);
+        emit_byte(b, 0x89);
+        emit_modrm(b, 2, src, RDI);
+        emit_u32(b, (uint32_t)loc->val);
+    }
+}
+
+/* jmp, or jcc if cc isn't -1, to an instruction of the region or out of it */
+void emit_jump(jit_buf_s *b, int cc, size_t target, int is_exit)
+{
+    if (cc < 0) {
+        emit_byte(b, 0xe9);
+    } else {
+        emit_byte(b, 0x0f);
+        emit_byte(b, (unsigned char)(0x80 | cc));
+    }
+
+    b->fixups[b->fixup_cnt].pos = b->len;
+    b->fixups[b->fixup_cnt].target = target;
+    b->fixups[b->fixup_cnt].is_exit = is_exit;
+    b->fixup_cnt++;
+
+    emit_u32(b, 0);
+}
+
+#define JIT_LOC(i, loc) \
+do { \
+    (void)jit_operand(prog, jit, &args[i], &loc); \
+    if (loc.kind == LOCAL_LOC && reg_of[args[i].val] >= 0) { \
+        loc.kind = REG_LOC; \
+        loc.val = reg_of[args[i].val]; \
+    } \
+} while (0)
+
+void emit_instruction(jit_buf_s *b, program_s *prog, jit_s *jit,
+                      const int *reg_of, size_t pos, size_t head, size_t end)
+{
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
+    const bytecode_s *ins = &img->code[pos];
+    const operand_s *args = &img->opnds[ins->args];
+    instruction_id_e code = bytecode_base_code(ins->code);
+    jit_loc_s dst, src1, src2;
+    size_t target, skip = 0;
+    int cc = -1;
+
+    switch (code) {
+        case SET_SYM:
+            JIT_LOC(0, dst);
+            JIT_LOC(1, src1);
+            emit_load(b, RAX, &src1);
+            emit_store(b, &dst, RAX);
+            return;
+        case ADD_SYM:
+        case SUB_SYM:
+        case MUL_SYM:
+        case DIV_SYM:
+        case MOD_SYM:
+            JIT_LOC(0, dst);
+            JIT_LOC(1, src1);
+            JIT_LOC(2, src2);
+            emit_load(b, RAX, &src1);
+            emit_load(b, RCX, &src2);
+
+            if (code == ADD_SYM) {
+                emit_byte(b, 0x01); //add eax, ecx
+                emit_modrm(b, 3, RCX, RAX);
+            } else if (code == SUB_SYM) {
+                emit_byte(b, 0x29); //sub eax, ecx
+                emit_modrm(b, 3, RCX, RAX);
+            } else if (code == MUL_SYM) {
+                emit_byte(b, 0x0f); //imul eax, ecx
+                emit_byte(b, 0xaf);
+                emit_modrm(b, 3, RAX, RCX);
+            } else {
+                emit_byte(b, 0x99); //cdq
+                emit_byte(b, 0xf7); //idiv ecx
+                emit_modrm(b, 3, 7, RCX);
+            }
+
+            emit_store(b, &dst, (code == MOD_SYM) ? RDX : RAX);
+            return;
+        case BRGT_SYM: cc = CC_G; break;
+        case BRGE_SYM: cc = CC_GE; break;
+        case BRLT_SYM: cc = CC_L; break;
+        case BRLE_SYM: cc = CC_LE; break;
+        case BREQ_SYM: cc = CC_E; break;
+        default: break;
+    }
+
+    if (cc >= 0) {
+        JIT_LOC(0, src1);
+        JIT_LOC(1, src2);
+        emit_load(b, RAX, &src1);
+        emit_load(b, RCX, &src2);
+        emit_byte(b, 0x39); //cmp eax, ecx
+        emit_modrm(b, 3, RCX, RAX);
+        target = (size_t)args[2].val;
+    } else {
+        target = (size_t)args[0].val;
+    }
+
+    if (target < head || target >= end) {
+        emit_jump(b, cc, target, 1);
+    } else if (target > pos) {
+        emit_jump(b, cc, target, 0);
+    } else {
+        //every backward jump uses up the budget of the instructions it repeats,
+        //so that a loop gives the runtime back to the scheduler in time
+        if (cc >= 0) {
+            emit_byte(b, 0x0f);
+            emit_byte(b, (unsigned char)(0x80 | CC_INVERT(cc)));
+            skip = b->len;
+            emit_u32(b, 0);
+        }
+
+        emit_byte(b, 0x49); //sub r9, imm32
+        emit_byte(b, 0x81);
+        emit_modrm(b, 3, 5, R9);
+        emit_u32(b, (uint32_t)(pos - target + 1));
+
+        emit_jump(b, CC_LE, target, 1);
+        emit_jump(b, -1, target, 0);
+
+        if (cc >= 0) {
+            uint32_t rel = (uint32_t)(b->len - (skip + 4));
+            memcpy(b->p + skip, &rel, sizeof(rel));
+        }
+    }
+}
+
+#endif //SIMBLY_JIT_X86_64
+
+/* compiles the longest run of instructions that can be compiled, starting from
+ * the head of the region. The most used locals of the region are kept in
+ * registers for as long as the native code runs */
+int jit_compile_region(program_s *prog, jit_s *jit, jit_region_s *region)
+{
+#ifdef SIMBLY_JIT_X86_64
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
+    size_t head = region->head, end, epilogue, *ins_off, buf_size, page;
+    unsigned int *uses, max_uses;
+    int reg_of_slot[ARRAY_LEN(alloc_regs)], *reg_of, best;
+    jit_buf_s b;
+    void *buf;
+
+    for (end = head; end < img->len && end - head < JIT_MAX_REGION_LEN; end++) {
+        if (!jittable(prog, jit, end)) {
+            break;
+        }
+    }
+
+    if (end - head < 2) {
+        return 0;
+    }
+
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    buf_size = ((end - head) * JIT_INS_MAX_BYTES + JIT_FRAME_MAX_BYTES + page - 1) & ~(page - 1);
+
+    buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buf == MAP_FAILED) {
+        dbg_msg(prog, "couldn't allocate memory for native code");
+        return 0;
+    }
+
+    //count the uses of every local, and give registers to the most used ones
+    ENO(uses = calloc(img->local_cnt + 1, sizeof(unsigned int)));
+    ENO(reg_of = malloc(sizeof(int) * (img->local_cnt + 1)));
+
+    for (size_t i = 0; i < img->local_cnt; i++) {
+        reg_of[i] = -1;
+    }
+
+    for (size_t i = head; i < end; i++) {
+        const operand_s *args = &img->opnds[img->code[i].args];
+
+        for (unsigned int j = 0; j < img->code[i].argc; j++) {
+            if (args[j].kind == LOCAL_OPND) {
+                uses[args[j].val]++;
+            }
+        }
+    }
+
+    for (size_t r = 0; r < ARRAY_LEN(alloc_regs); r++) {
+        best = -1;
+        max_uses = 0;
+
+        for (size_t i = 0; i < img->local_cnt; i++) {
+            if (uses[i] > max_uses && reg_of[i] < 0) {
+                max_uses = uses[i];
+                best = (int)i;
+            }
+        }
+
+        reg_of_slot[r] = best;
+
+        if (best >= 0) {
+            reg_of[best] = alloc_regs[r];
+        }
+    }
+
+    b.p = (unsigned char*)buf;
+    b.len = 0;
+    b.fixup_cnt = 0;
+    ENO(b.fixups = malloc(sizeof(jit_fixup_s) * 2 * (end - head)));
+    ENO(ins_off = malloc(sizeof(size_t) * (end - head)));
+
+    //push rbx, r12-r15; mov r8, rdx; mov r9, rcx
+    emit_byte(&b, 0x53);
+    for (unsigned char r = 0x54; r <= 0x57; r++) {
+        emit_byte(&b, 0x41);
+        emit_byte(&b, r);
+    }
+    emit_byte(&b, 0x49); emit_byte(&b, 0x89); emit_modrm(&b, 3, RDX, R8);
+    emit_byte(&b, 0x49); emit_byte(&b, 0x89); emit_modrm(&b, 3, RCX, R9);
+
+    for (size_t r = 0; r < ARRAY_LEN(alloc_regs); r++) {
+        if (reg_of_slot[r] >= 0) {
+            jit_loc_s loc = {LOCAL_LOC, reg_of_slot[r] * (int)sizeof(local_var_s) +
+                                        (int)offsetof(local_var_s, val)};
+
+            emit_load(&b, alloc_regs[r], &loc);
+        }
+    }
+
+    for (size_t i = head; i < end; i++) {
+        ins_off[i - head] = b.len;
+        emit_instruction(&b, prog, jit, reg_of, i, head, end);
+    }
+
+    //running past the last instruction of the region; mov qword [r8], end
+    emit_byte(&b, 0x49); emit_byte(&b, 0xc7); emit_modrm(&b, 0, 0, R8);
+    emit_u32(&b, (uint32_t)end);
+
+    epilogue = b.len;
+
+    for (size_t r = 0; r < ARRAY_LEN(alloc_regs); r++) {
+        if (reg_of_slot[r] >= 0) {
+            jit_loc_s loc = {LOCAL_LOC, reg_of_slot[r] * (int)sizeof(local_var_s) +
+                                        (int)offsetof(local_var_s, val)};
+
+            emit_store(&b, &loc, alloc_regs[r]);
+        }
+    }
+
+    //pop r15-r12, rbx; mov rax, r9; ret
+    for (unsigned char r = 0x5f; r >= 0x5c; r--) {
+        emit_byte(&b, 0x41);
+        emit_byte(&b, r);
+    }
+    emit_byte(&b, 0x5b);
+    emit_byte(&b, 0x4c); emit_byte(&b, 0x89); emit_modrm(&b, 3, R9, RAX);
+    emit_byte(&b, 0xc3);
+
+    for (size_t i = 0; i < b.fixup_cnt; i++) {
+        jit_fixup_s *fix = &b.fixups[i];
+        uint32_t rel;
+
+        if (fix->is_exit) {
+            //mov qword [r8], target; jmp epilogue
+            rel = (uint32_t)(b.len - (fix->pos + 4));
+            memcpy(b.p + fix->pos, &rel, sizeof(rel));
+
+            emit_byte(&b, 0x49); emit_byte(&b, 0xc7); emit_modrm(&b, 0, 0, R8);
+            emit_u32(&b, (uint32_t)fix->target);
+            emit_byte(&b, 0xe9);
+            emit_u32(&b, (uint32_t)(epilogue - (b.len + 4)));
+        } else {
+            rel = (uint32_t)(ins_off[fix->target - head] - (fix->pos + 4));
+            memcpy(b.p + fix->pos, &rel, sizeof(rel));
+        }
+    }
+
+    ASRT(b.len <= buf_size);
+
+    free(b.fixups);
+    free(ins_off);
+    free(uses);
+    free(reg_of);
+
+    if (mprotect(buf, buf_size, PROT_READ | PROT_EXEC) == -1) {
+        dbg_msg(prog, "couldn't make native code executable");
+        munmap(buf, buf_size);
+        return 0;
+    }
+
+    region->buf = buf;
+    region->buf_len = buf_size;
+    //converting from void* to a function pointer is how native code is called on POSIX
+    *(void**)&region->fn = buf;
+
+    dbg_msg(prog, "compiled instructions %zu to %zu to %zu bytes of native code", head, end - 1, b.len);
+
+    return 1;
+#else
+    (void)prog; (void)jit; (void)region;
+    return 0;
+#endif
+}
+
+/* builds the JIT state of a program, with a region on every label that's
+ * followed by at least two instructions that can be compiled */
+jit_s *jit_init(program_s *prog, const bytecode_s *code)
+{
+    bytecode_image_s *img = (bytecode_image_s*)prog->image;
+    jit_s *jit;
+
+    ENO(jit = malloc(sizeof(jit_s)));
+
+    jit->orig = code;
+    jit->len = img->len;
+    jit->region_cnt = 0;
+
+    ENO(jit->code = malloc(sizeof(bytecode_s) * (img->len + 1)));
+    memcpy(jit->code, code, sizeof(bytecode_s) * img->len);
+
+    jit->is_array = bytecode_array_locals(img);
+    ENO(jit->region_at = calloc(img->len + 1, sizeof(jit_region_s*)));
+    ENO(jit->regions = malloc(sizeof(jit_region_s) * (img->len + 1)));
+
+    for (size_t i = 0; i < img->opnd_len; i++) {
+        size_t head = (size_t)img->opnds[i].val;
+
+        if (img->opnds[i].kind != LABEL_OPND || jit->region_at[head] ||
+            head + 1 >= img->len || !jittable(prog, jit, head) || !jittable(prog, jit, head + 1)) {
+            continue;
+        }
+
+        jit_region_s *region = &jit->regions[jit->region_cnt++];
+
+        region->head = head;
+        region->hits = 0;
+        region->fn = NULL;
+        region->buf = NULL;
+        region->buf_len = 0;
+
+        jit->region_at[head] = region;
+        jit->code[head].code = JIT_ENTER_SYM;
+    }
+
+    return jit;
+}
+
+void jit_free(jit_s *jit)
+{
+    if (jit) {
+        for (size_t i = 0; i < jit->region_cnt; i++) {
+            if (jit->regions[i].buf) {
+                munmap(jit->regions[i].buf, jit->regions[i].buf_len);
+            }
+        }
+
+        free(jit->code);
+        free(jit->is_array);
+        free(jit->region_at);
+        free(jit->regions);
+        free(jit);
+    }
+}
+
+/* runs the region that starts at head, if it's hot enough to be compiled.
+ * Returns 0 if the interpreter has to run the instruction at head instead */
+int jit_enter(program_s *prog, size_t head, size_t budget, size_t *cnt)
+{
+    jit_s *jit = (jit_s*)prog->jit;
+    jit_region_s *region = jit->region_at[head];
+    long left;
+
+    if (!region->fn) {
+        if (++region->hits < JIT_HOT_THRESHOLD) {
+            return 0;
+        }
+
+        if (!jit_compile_region(prog, jit, region)) {
+            //don't try again
+            jit->code[head] = jit->orig[head];
+            return 0;
+        }
+    }
+
+    left = region->fn(prog->locals, prog->argv, &prog->pc, (long)budget);
+    *cnt += (size_t)((long)budget - left);
+
+    return 1;
+}
@@ -0,0 +1,44 @@
+#ifndef SIMBLY_JIT_H__
+#define SIMBLY_JIT_H__
+
+#include "common.h"
+#include "program.h"
+#include "bytecode.h"
+
+
+//times a region has to be entered before it's compiled
+#define JIT_HOT_THRESHOLD 64
+#define JIT_MAX_REGION_LEN 256
+
+/* runs the native code of a region, starting from its first instruction.
+ * Returns what's left of the instruction budget, after it's updated pc
+ * with the instruction to continue from in the interpreter */
+typedef long (*jit_fn)(local_var_s *regs, const int *argv, size_t *pc, long budget);
+
+/* a region is a run of consecutive instructions, starting from a label,
+ * that only move integers between locals and branch (SET, arithmetic and
+ * branch instructions). Branches that leave the region exit to the interpreter */
+typedef struct _jit_region_s {
+    size_t head;
+    unsigned int hits;
+    jit_fn fn;
+    void *buf;
+    size_t buf_len;
+} jit_region_s;
+
+typedef struct _jit_s {
+    bytecode_s *code; //the code the program runs, with JIT_ENTER on the head of every region
+    const bytecode_s *orig; //the code the program would run without the JIT
+    size_t len;
+    jit_region_s *regions;
+    size_t region_cnt;
+    jit_region_s **region_at; //the region that starts at each instruction, if any
+    unsigned char *is_array; //locals that are indexed anywhere in the program
+} jit_s;
+
+
+jit_s *jit_init(program_s *prog, const bytecode_s *code);
+void jit_free(jit_s *jit);
+int jit_enter(program_s *prog, size_t head, size_t budget, size_t *cnt);
+
+#endif //SIMBLY_JIT_H__
@@ -0,0 +1,372 @@
+#include "loop.h"
+#include "error.h"
+
+
+typedef struct _loop_ctx_s {
+    bytecode_image_s *img;
+    unsigned char *is_array; //locals that are indexed anywhere in the program
+    unsigned char *written; //locals that are written in the loop being recognized
+    int var;
+} loop_ctx_s;
+
+
+static int is_scalar(loop_ctx_s *ctx, const operand_s *op);
+static int is_elem(loop_ctx_s *ctx, const operand_s *op);
+static int is_invariant(loop_ctx_s *ctx, const operand_s *op);
+static int is_statement(instruction_id_e code);
+static int increment_step(loop_ctx_s *ctx, const bytecode_s *ins);
+static int recognize_statement(loop_ctx_s *ctx, const bytecode_s *ins, loop_stmt_s *stmt);
+static int accesses(const loop_stmt_s *stmt, int slot);
+static int recognize_body(loop_ctx_s *ctx, size_t start, size_t end, loop_s *loop);
+static int recognize_loop(loop_ctx_s *ctx, size_t head, size_t start, size_t end, loop_s *loop);
+static int find_loop(loop_ctx_s *ctx, size_t head, loop_s *loop);
+
+
+
+
+int is_scalar(loop_ctx_s *ctx, const operand_s *op)
+{
+    return op->kind == LOCAL_OPND && !ctx->is_array[op->val];
+}
+
+//$a[$i]
+int is_elem(loop_ctx_s *ctx, const operand_s *op)
+{
+    return op->kind == LOCAL_ARR_OPND && ctx->img->opnds[op->idx].kind == LOCAL_OPND &&
+           ctx->img->opnds[op->idx].val == ctx->var;
+}
+
+/* values that are the same on every iteration, and can be read without
+ * an error (the index of argv is checked when the loop runs) */
+int is_invariant(loop_ctx_s *ctx, const operand_s *op)
+{
+    switch (op->kind) {
+        case IMM_OPND:
+        case ARGC_OPND:
+            return 1;
+        case ARGV_OPND:
+            return ctx->img->opnds[op->idx].kind == IMM_OPND;
+        case LOCAL_OPND:
+            return is_scalar(ctx, op) && !ctx->written[op->val];
+        default:
+            return 0;
+    }
+}
+
+int is_statement(instruction_id_e code)
+{
+    switch (bytecode_base_code(code)) {
+        case SET_SYM:
+        case ADD_SYM:
+        case SUB_SYM:
+        case MUL_SYM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* the step of an ADD/SUB $i $i 1, or 0 if the instruction isn't one */
+int increment_step(loop_ctx_s *ctx, const bytecode_s *ins)
+{
+    const operand_s *args = &ctx->img->opnds[ins->args];
+    instruction_id_e code = bytecode_base_code(ins->code);
+    const operand_s *val;
+
+    if ((code != ADD_SYM && code != SUB_SYM) || args[0].kind != LOCAL_OPND || args[0].val != ctx->var) {
+        return 0;
+    }
+
+    if (args[1].kind == LOCAL_OPND && args[1].val == ctx->var) {
+        val = &args[2];
+    } else if (code == ADD_SYM && args[2].kind == LOCAL_OPND && args[2].val == ctx->var) {
+        val = &args[1];
+    } else {
+        return 0;
+    }
+
+    if (val->kind != IMM_OPND || (val->val != 1 && val->val != -1)) {
+        return 0;
+    }
+
+    return (code == ADD_SYM) ? val->val : -val->val;
+}
+
+int recognize_statement(loop_ctx_s *ctx, const bytecode_s *ins, loop_stmt_s *stmt)
+{
+    const operand_s *args = &ctx->img->opnds[ins->args];
+    instruction_id_e code = bytecode_base_code(ins->code);
+
+    stmt->op = code;
+    stmt->dst = args[0].val;
+    stmt->src[0] = stmt->src[1] = NULL;
+
+    if (is_elem(ctx, &args[0])) {
+        const operand_s *a = &args[1], *b = &args[2];
+
+        if (code == SET_SYM) {
+            stmt->src[0] = a;
+            stmt->kind = is_elem(ctx, a) ? LOOP_ELEM_COPY : LOOP_ELEM_FILL;
+            return is_elem(ctx, a) || is_invariant(ctx, a);
+        }
+
+        //only addition and multiplication can have the value first
+        if (!is_elem(ctx, a) && code != SUB_SYM) {
+            a = &args[2];
+            b = &args[1];
+        }
+
+        stmt->src[0] = a;
+        stmt->src[1] = b;
+        stmt->kind = is_elem(ctx, b) ? LOOP_ELEM_BINARY : LOOP_ELEM_VALUE;
+        return is_elem(ctx, a) && (is_elem(ctx, b) || is_invariant(ctx, b));
+    }
+
+    //the accumulators can only be added to, or subtracted from
+    if (code == SET_SYM || code == MUL_SYM || !is_scalar(ctx, &args[0]) || args[0].val == ctx->var) {
+        return 0;
+    }
+
+    if (args[1].kind == LOCAL_OPND && args[1].val == stmt->dst) {
+        stmt->src[0] = &args[2];
+    } else if (code == ADD_SYM && args[2].kind == LOCAL_OPND && args[2].val == stmt->dst) {
+        stmt->src[0] = &args[1];
+    } else {
+        return 0;
+    }
+
+    if (stmt->src[0]->kind == LOCAL_OPND && stmt->src[0]->val == ctx->var) {
+        stmt->kind = LOOP_ACC_INDEX;
+    } else if (is_elem(ctx, stmt->src[0])) {
+        stmt->kind = LOOP_ACC_ELEM;
+    } else if (is_invariant(ctx, stmt->src[0])) {
+        stmt->kind = LOOP_ACC_VALUE;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+//whether a statement reads or writes an element of the array in slot
+int accesses(const loop_stmt_s *stmt, int slot)
+{
+    if (stmt->kind != LOOP_ACC_INDEX && stmt->kind != LOOP_ACC_VALUE && stmt->kind != LOOP_ACC_ELEM &&
+        stmt->dst == slot) {
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < 2; i++) {
+        if (stmt->src[i] && stmt->src[i]->kind == LOCAL_ARR_OPND && stmt->src[i]->val == slot) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* recognizes the statements between start and end, which have to include
+ * exactly one increment of the induction variable */
+int recognize_body(loop_ctx_s *ctx, size_t start, size_t end, loop_s *loop)
+{
+    bytecode_image_s *img = ctx->img;
+    int shift = 0;
+
+    loop->stmt_cnt = 0;
+    loop->step = 0;
+
+    for (size_t i = start; i < end; i++) {
+        int step = increment_step(ctx, &img->code[i]);
+
+        if (step) {
+            if (loop->step) {
+                return 0;
+            }
+
+            loop->step = shift = step;
+        } else {
+            loop_stmt_s *stmt = &loop->stmts[loop->stmt_cnt];
+
+            if (loop->stmt_cnt++ == LOOP_MAX_STMTS || !recognize_statement(ctx, &img->code[i], stmt)) {
+                return 0;
+            }
+
+            stmt->shift = shift;
+        }
+    }
+
+    if (!loop->step) {
+        return 0;
+    }
+
+    /* the statements after the increment see the elements of the next
+     * iteration, so an array that's written can't be on both sides of it */
+    for (unsigned int i = 0; i < loop->stmt_cnt; i++) {
+        const loop_stmt_s *stmt = &loop->stmts[i];
+
+        if (stmt->kind == LOOP_ACC_INDEX || stmt->kind == LOOP_ACC_VALUE || stmt->kind == LOOP_ACC_ELEM) {
+            continue;
+        }
+
+        for (unsigned int j = 0; j < loop->stmt_cnt; j++) {
+            if (loop->stmts[j].shift != stmt->shift && accesses(&loop->stmts[j], stmt->dst)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* recognizes the loop that starts at head, with the induction variable in ctx->var */
+int recognize_loop(loop_ctx_s *ctx, size_t head, size_t start, size_t end, loop_s *loop)
+{
+    const bytecode_s *branch = &ctx->img->code[loop->do_while ? end : head];
+    const operand_s *args = &ctx->img->opnds[branch->args];
+    instruction_id_e cmp = bytecode_base_code(branch->code);
+
+    if (!recognize_body(ctx, start, end, loop)) {
+        return 0;
+    }
+
+    if (args[0].kind == LOCAL_OPND && args[0].val == ctx->var) {
+        loop->bound = &args[1];
+    } else {
+        loop->bound = &args[0];
+        //$i has to be on the left
+        cmp = (cmp == BRGT_SYM) ? BRLT_SYM : (cmp == BRGE_SYM) ? BRLE_SYM :
+              (cmp == BRLT_SYM) ? BRGT_SYM : (cmp == BRLE_SYM) ? BRGE_SYM : cmp;
+    }
+
+    //the head exits the loop when the comparison holds
+    if (!loop->do_while) {
+        cmp = (cmp == BRGT_SYM) ? BRLE_SYM : (cmp == BRGE_SYM) ? BRLT_SYM :
+              (cmp == BRLT_SYM) ? BRGE_SYM : (cmp == BRLE_SYM) ? BRGT_SYM : cmp;
+    }
+
+    loop->cmp = cmp;
+
+    //$i has to move towards the bound
+    if (loop->step > 0 && cmp != BRLT_SYM && cmp != BRLE_SYM) {
+        return 0;
+    }
+
+    if (loop->step < 0 && cmp != BRGT_SYM && cmp != BRGE_SYM) {
+        return 0;
+    }
+
+    return is_invariant(ctx, loop->bound);
+}
+
+/* finds the loop that starts at head, if there's one. Its induction
+ * variable is one of the locals compared by the branch of the loop */
+int find_loop(loop_ctx_s *ctx, size_t head, loop_s *loop)
+{
+    bytecode_image_s *img = ctx->img;
+    const operand_s *args = &img->opnds[img->code[head].args];
+    size_t start = head, end;
+    int ret = 0;
+
+    loop->do_while = is_statement(img->code[head].code);
+
+    //the head of a loop that's tested first is the branch that exits it
+    if (!loop->do_while) {
+        if (bytecode_base_code(img->code[head].code) == BRA_SYM || img->code[head].argc != 3 ||
+            args[2].kind != LABEL_OPND) {
+            return 0;
+        }
+
+        loop->exit = (size_t)args[2].val;
+        start++;
+    }
+
+    for (end = start; end < img->len && is_statement(img->code[end].code); end++)
+        ;
+
+    //the loop ends with a jump back to the head
+    if (end >= img->len || end - start < 2 || end - start > LOOP_MAX_STMTS + 1) {
+        return 0;
+    }
+
+    if (!loop->do_while && loop->exit >= head && loop->exit <= end) {
+        return 0;
+    }
+
+    if (!loop->do_while) {
+        if (img->code[end].code != BRA_SYM || img->opnds[img->code[end].args].val != (int)head) {
+            return 0;
+        }
+    } else {
+        args = &img->opnds[img->code[end].args];
+
+        if (bytecode_base_code(img->code[end].code) == BRA_SYM || img->code[end].argc != 3 ||
+            args[2].kind != LABEL_OPND || args[2].val != (int)head) {
+            return 0;
+        }
+
+        loop->exit = end + 1;
+    }
+
+    //every value that's read has to be checked against every local that's written
+    for (size_t i = start; i < end; i++) {
+        ctx->written[img->opnds[img->code[i].args].val] = 1;
+    }
+
+    for (unsigned int k = 0; k < 2 && !ret; k++) {
+        if (is_scalar(ctx, &args[k])) {
+            ctx->var = args[k].val;
+            ret = recognize_loop(ctx, head, start, end, loop);
+        }
+    }
+
+    for (size_t i = start; i < end; i++) {
+        ctx->written[img->opnds[img->code[i].args].val] = 0;
+    }
+
+    if (ret) {
+        loop->var = ctx->var;
+    }
+
+    return ret;
+}
+
+/* finds the counted loops of an image, and replaces their heads in the fused
+ * code with LOOP. Has to be called after the fused code is built */
+void loop_recognize(bytecode_image_s *img)
+{
+    loop_ctx_s ctx;
+    loop_s loop;
+
+    ctx.img = img;
+    ctx.is_array = bytecode_array_locals(img);
+    ENO(ctx.written = calloc(img->local_cnt + 1, sizeof(unsigned char)));
+
+    img->loop_cnt = 0;
+    ENO(img->loops = malloc(sizeof(loop_s) * (img->len / 2 + 1)));
+    ENO(img->loop_at = calloc(img->len + 1, sizeof(loop_s*)));
+
+    for (size_t i = 0; i < img->opnd_len; i++) {
+        size_t head = (size_t)img->opnds[i].val;
+
+        //every loop is jumped to, at its head
+        if (img->opnds[i].kind != LABEL_OPND || head >= img->len || img->loop_at[head] ||
+            !find_loop(&ctx, head, &loop)) {
+            continue;
+        }
+
+        loop.orig = img->fused[head];
+
+        img->loops[img->loop_cnt] = loop;
+        img->loop_at[head] = &img->loops[img->loop_cnt++];
+        img->fused[head].code = LOOP_SYM;
+    }
+
+    free(ctx.written);
+    free(ctx.is_array);
+}
+
+void loop_free(bytecode_image_s *img)
+{
+    free(img->loops);
+    free(img->loop_at);
+}
@@ -0,0 +1,58 @@
+#ifndef SIMBLY_LOOP_H__
+#define SIMBLY_LOOP_H__
+
+#include "common.h"
+#include "bytecode.h"
+
+
+//the most statements the body of a loop can have, for it to be recognized
+#define LOOP_MAX_STMTS 8
+
+/* what a statement of a loop body does on each iteration. $i is the induction
+ * variable, x is a value that doesn't change in the loop, $acc is a local that
+ * is only written by the statement and $a, $b, $c are local arrays indexed by $i */
+typedef enum _loop_stmt_kind_e {
+    LOOP_ACC_INDEX,     //ADD/SUB $acc $acc $i
+    LOOP_ACC_VALUE,     //ADD/SUB $acc $acc x
+    LOOP_ACC_ELEM,      //ADD/SUB $acc $acc $a[$i]
+    LOOP_ELEM_BINARY,   //ADD/SUB/MUL $c[$i] $a[$i] $b[$i]
+    LOOP_ELEM_VALUE,    //ADD/SUB/MUL $c[$i] $a[$i] x
+    LOOP_ELEM_FILL,     //SET $c[$i] x
+    LOOP_ELEM_COPY      //SET $c[$i] $a[$i]
+} loop_stmt_kind_e;
+
+typedef struct _loop_stmt_s {
+    loop_stmt_kind_e kind;
+    instruction_id_e op; //ADD, SUB or MUL
+    int dst; //the slot of $acc or $c
+    const operand_s *src[2]; //$a and $b, or x
+    int shift; //the statement comes after the increment of $i, which it sees
+} loop_stmt_s;
+
+/* a counted loop, in one of the shapes
+ *
+ *  head: BRcc $i n exit            head: <body>
+ *        <body>                          ADD $i $i 1
+ *        ADD $i $i 1                     BRcc $i n head
+ *        BRA head
+ *
+ * where the increment can be anywhere in the body, the step can be 1 or -1
+ * and the comparison bounds $i from the direction it moves to. Its head is
+ * replaced with LOOP in the fused code, which runs the whole loop at once */
+typedef struct _loop_s {
+    bytecode_s orig; //the instruction that was replaced by LOOP
+    int var; //the slot of $i
+    int step;
+    instruction_id_e cmp; //BRLT, BRLE, BRGT or BRGE; the loop goes on while $i cmp n
+    const operand_s *bound; //n
+    int do_while; //the body runs once before the first comparison
+    size_t exit;
+    loop_stmt_s stmts[LOOP_MAX_STMTS];
+    unsigned int stmt_cnt;
+} loop_s;
+
+
+void loop_recognize(bytecode_image_s *img);
+void loop_free(bytecode_image_s *img);
+
+#endif //SIMBLY_LOOP_H__
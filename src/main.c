@@ -5,6 +5,7 @@
 #include "scanner.h"
 #include "global.h"
 #include "error.h"
+#include "aot.h"
 #include <unistd.h>
 #include <sys/sysinfo.h>
 
@@ -13,10 +14,14 @@
 #define DEFAULT_THREAD_NUM 4
 
 const char *help_msg[] = {
-    "run executes simbly programs. command usage -> run <source_file_name> <optional_integer_args_separated_by_whitespace>",
+    "run executes simbly programs. command usage -> run <optional_options> <source_file_name> <optional_integer_args_separated_by_whitespace>\n"
+    "\toptions: -nofuse runs the program without replacing common instruction sequences with superinstructions\n"
+    "\t         -jit compiles the loops the program spends most of its time in to native code\n"
+    "\t         -noaot interprets the program even if it was compiled with the compile command",
     "kill stops the execution of the simbly program with the specified ID. command usage -> kill <non_negative_integer>",
     "list lists the program that's currently running, and the total number of programs, on each runtime. command usage -> list",
-    "help prints this message. command usage -> help"
+    "help prints this message. command usage -> help",
+    "compile translates a simbly program to C and builds it to a shared object, that's used by every run of the program from then on. command usage -> compile <source_file_name>"
 };
 
 
@@ -86,37 +91,37 @@ char *read_line(void)
     return buff;
 }
 
-void mark_program_as_finished(runtime_s **rt_arr, int rt_cnt, int id)
+/* reads the options of a run command, and returns the source file name
+ * that follows them. Returns NULL if an option isn't recognized */
+char *parse_run_options(char **saveptr, unsigned int *opts)
 {
-    CDLListNode *curr;
-    program_s *prog;
+    char *word;
+
+    *opts = 0;
+
+    while ((word = strtok_r(NULL, " ", saveptr)) && word[0] == '-') {
+        if (!strcmp("-nofuse", word)) {
+            *opts |= PROGRAM_OPT_NO_FUSION;
+        } else if (!strcmp("-jit", word)) {
+            *opts |= PROGRAM_OPT_JIT;
+        } else if (!strcmp("-noaot", word)) {
+            *opts |= PROGRAM_OPT_NO_AOT;
+        } else {
+            shell_msg("unrecognized run option \"%s\"", word);
+            return NULL;
+        }
+    }
+
+    return word;
+}
 
+void mark_program_as_finished(runtime_s **rt_arr, int rt_cnt, int id)
+{
     for (int i = 0; i < rt_cnt; i++) {
-        PTH(pthread_mutex_lock(&rt_arr[i]->lock));
-        curr = rt_arr[i]->program_list;
-
-        if (curr) {
-            do {
-                prog = (program_s*)curr->pData;
-
-                if (prog->argv[0] == id) {
-                    id = -1;
-                    //wake up the thread if it's asleep to notify it that
-                    //it's killed
-                    if (prog->state == BLOCKED) {
-                        global_var_s *var = (global_var_s*)prog->sem;
-
-                        PTH(pthread_mutex_lock(&var->mtx));
-                        var->count[prog->blocked_idx] = 1;
-                        PTH(pthread_mutex_unlock(&var->mtx));
-                    }
-                    program_stop(prog, 1);
-                    break;
-                }
-                curr = curr->nxt;
-            } while (curr != rt_arr[i]->program_list);
+        if (runtime_kill_program(rt_arr[i], id)) {
+            id = -1;
+            break;
         }
-        PTH(pthread_mutex_unlock(&rt_arr[i]->lock));
     }
 
     if (id != -1) {
@@ -147,10 +152,26 @@ void print_banner(const char *banner)
 
 int main(int argc, char **argv)
 {
-    (void)argc; (void)argv;
-
     exec_init();
 
+    //simbly compile <files> builds the files without starting the shell
+    if (argc > 1) {
+        int ret = EXIT_SUCCESS;
+
+        if (strcmp("compile", argv[1]) || argc == 2) {
+            fprintf(stderr, "usage: %s [compile <source_file_name>...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 2; i < argc; i++) {
+            if (!aot_compile(argv[i])) {
+                ret = EXIT_FAILURE;
+            }
+        }
+
+        return ret;
+    }
+
     char *word, *line, *saveptr;
     runtime_s **rt_arr;
     int rt_cnt, rt_min_idx;
@@ -209,7 +230,8 @@ int main(int argc, char **argv)
 
         } else if (!strcmp("r", word) || !strcmp("run", word)) {
 
-            char *fname = strtok_r(NULL, " ", &saveptr);
+            unsigned int opts;
+            char *fname = parse_run_options(&saveptr, &opts);
 
             if (!fname) {
 
@@ -274,7 +296,7 @@ int main(int argc, char **argv)
                             PTH(pthread_mutex_unlock(&rt_arr[i]->lock));
                         }
 
-                        runtime_attach_program(rt_arr[rt_min_idx], program_init(fname, _argc, _argv));
+                        runtime_attach_program(rt_arr[rt_min_idx], program_init(fname, _argc, _argv, opts));
                     }
 
                     free(_argv);
@@ -283,22 +305,35 @@ int main(int argc, char **argv)
                 }
 
             }
+        } else if (!strcmp("c", word) || !strcmp("compile", word)) {
+
+            char *fname = strtok_r(NULL, " ", &saveptr);
+
+            if (!fname) {
+                shell_msg(help_msg[4]);
+            } else {
+                (void)aot_compile(fname);
+            }
+
         } else if (!strcmp("l", word) || !strcmp("list", word)) {
             int i, tmp_id, tmp_cnt;
 
             for (i = 0; i < rt_cnt; i++) {
                 PTH(pthread_mutex_lock(&rt_arr[i]->lock));
 
+                tmp_cnt = rt_arr[i]->program_cnt;
+
                 if (rt_arr[i]->curr) {
                     tmp_id = ((program_s*)rt_arr[i]->curr->pData)->argv[0];
-                    tmp_cnt = rt_arr[i]->program_cnt;
                 } else {
                     tmp_id = -1;
                 }
 
                 PTH(pthread_mutex_unlock(&rt_arr[i]->lock));
 
-                if (tmp_id == -1) {
+                if (tmp_id == -1 && tmp_cnt) {
+                    shell_msg("All %d programs on runtime %ld are blocked or sleeping", tmp_cnt, (long)rt_arr[i]->thrd_id);
+                } else if (tmp_id == -1) {
                     shell_msg("No programs are running on runtime %ld", (long)rt_arr[i]->thrd_id);
                 } else {
                     shell_msg("Program %d is currently running on runtime %ld. Total programs running %d.", tmp_id, (long)rt_arr[i]->thrd_id, tmp_cnt);
@@ -307,7 +342,7 @@ int main(int argc, char **argv)
         } else if (!strcmp("h", word) || !strcmp("help", word)) {
             //printing these in one call and not in a loop, to avoid having messages
             //from running programs being printed while these are printed
-            shell_msg("%s\n%s\n%s\n%s", help_msg[0], help_msg[1], help_msg[2], help_msg[3]);
+            shell_msg("%s\n%s\n%s\n%s\n%s", help_msg[0], help_msg[1], help_msg[2], help_msg[3], help_msg[4]);
         } else {
             shell_msg("unrecognized command");
         }
@@ -0,0 +1,433 @@
+#include "optimize.h"
+#include "error.h"
+#include <limits.h>
+
+
+/* what's known about a local variable at some point of a basic block */
+typedef struct _local_info_s {
+    int known, val; //whether it holds a known integer value, and that value
+    int copy; //the slot of the local it holds a copy of, or -1
+} local_info_s;
+
+typedef struct _opt_ctx_s {
+    bytecode_image_s *img;
+    unsigned char *is_array; //locals that are indexed anywhere in the program
+    unsigned char *leader; //instructions that start a basic block
+    unsigned char *removed;
+    local_info_s *info;
+    int *touched; //the locals that info has to be reset for, at the end of a block
+    size_t touched_cnt;
+    unsigned int *reads;
+    size_t folded;
+} opt_ctx_s;
+
+
+static int is_scalar(opt_ctx_s *ctx, const operand_s *op);
+static int writes_local(instruction_id_e code);
+static int is_branch(instruction_id_e code);
+static int fold(instruction_id_e code, int val1, int val2, int *res);
+static void forget_local(opt_ctx_s *ctx, int slot);
+static void reset_block(opt_ctx_s *ctx);
+static void propagate_operand(opt_ctx_s *ctx, operand_s *op);
+static void propagate_constants(opt_ctx_s *ctx);
+static void remove_unreachable(opt_ctx_s *ctx);
+static void count_reads(opt_ctx_s *ctx, const operand_s *op, int is_dest);
+static int remove_dead_stores(opt_ctx_s *ctx);
+static size_t compact_code(opt_ctx_s *ctx);
+
+
+
+
+int is_scalar(opt_ctx_s *ctx, const operand_s *op)
+{
+    return op->kind == LOCAL_OPND && !ctx->is_array[op->val];
+}
+
+/* instructions that write to their first operand. The vector instructions
+ * that write to an array aren't here; only the index of their first
+ * operand is read, which is how other operands are treated anyway */
+int writes_local(instruction_id_e code)
+{
+    switch (code) {
+        case LOAD_SYM:
+        case SET_SYM:
+        case ADD_SYM:
+        case SUB_SYM:
+        case MUL_SYM:
+        case DIV_SYM:
+        case MOD_SYM:
+        case VSUM_SYM:
+        case VMIN_SYM:
+        case VMAX_SYM:
+        case FADD_SYM:
+        case SWAP_SYM:
+        case CAS_SYM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int is_branch(instruction_id_e code)
+{
+    switch (code) {
+        case BRGT_SYM:
+        case BRGE_SYM:
+        case BRLT_SYM:
+        case BRLE_SYM:
+        case BREQ_SYM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* evaluates an arithmetic instruction or a branch condition on known values.
+ * Returns 0 if the result isn't an int, e.g. on overflow or division by zero,
+ * so that the instruction is left to fail at run time like it always did */
+int fold(instruction_id_e code, int val1, int val2, int *res)
+{
+    long long tmp;
+
+    switch (code) {
+        case ADD_SYM: tmp = (long long)val1 + val2; break;
+        case SUB_SYM: tmp = (long long)val1 - val2; break;
+        case MUL_SYM: tmp = (long long)val1 * val2; break;
+        case DIV_SYM:
+        case MOD_SYM:
+            if (!val2 || (val1 == INT_MIN && val2 == -1)) {
+                return 0;
+            }
+
+            tmp = (code == DIV_SYM) ? val1 / val2 : val1 % val2;
+            break;
+        case BRGT_SYM: tmp = val1 > val2; break;
+        case BRGE_SYM: tmp = val1 >= val2; break;
+        case BRLT_SYM: tmp = val1 < val2; break;
+        case BRLE_SYM: tmp = val1 <= val2; break;
+        case BREQ_SYM: tmp = val1 == val2; break;
+        default:
+            return 0;
+    }
+
+    if (tmp < INT_MIN || tmp > INT_MAX) {
+        return 0;
+    }
+
+    *res = (int)tmp;
+    return 1;
+}
+
+/* a local was written; nothing is known about it, or about the locals that were copies of it */
+void forget_local(opt_ctx_s *ctx, int slot)
+{
+    for (size_t i = 0; i < ctx->touched_cnt; i++) {
+        if (ctx->info[ctx->touched[i]].copy == slot) {
+            ctx->info[ctx->touched[i]].copy = -1;
+        }
+    }
+
+    ctx->info[slot].known = 0;
+    ctx->info[slot].copy = -1;
+    ctx->touched[ctx->touched_cnt++] = slot;
+}
+
+void reset_block(opt_ctx_s *ctx)
+{
+    for (size_t i = 0; i < ctx->touched_cnt; i++) {
+        ctx->info[ctx->touched[i]].known = 0;
+        ctx->info[ctx->touched[i]].copy = -1;
+    }
+
+    ctx->touched_cnt = 0;
+}
+
+/* replaces a local that's read with its value, or with the local it's a
+ * copy of. Array indices are operands that are read too */
+void propagate_operand(opt_ctx_s *ctx, operand_s *op)
+{
+    if (is_scalar(ctx, op)) {
+        local_info_s *info = &ctx->info[op->val];
+
+        if (info->known) {
+            op->kind = IMM_OPND;
+            op->val = info->val;
+        } else if (info->copy >= 0) {
+            op->val = info->copy;
+        }
+    } else if (op->idx >= 0) {
+        propagate_operand(ctx, &ctx->img->opnds[op->idx]);
+    }
+}
+
+/* constant folding and copy propagation, inside each basic block. Branches
+ * that always go the same way become BRA, or are removed */
+void propagate_constants(opt_ctx_s *ctx)
+{
+    bytecode_image_s *img = ctx->img;
+
+    for (size_t i = 0; i < img->len; i++) {
+        bytecode_s *ins = &img->code[i];
+        operand_s *args = &img->opnds[ins->args];
+        int res;
+
+        if (ctx->leader[i]) {
+            reset_block(ctx);
+        }
+
+        //the operands that are read
+        for (unsigned int j = writes_local(ins->code) ? 1 : 0; j < ins->argc; j++) {
+            propagate_operand(ctx, &args[j]);
+        }
+
+        if (is_branch(ins->code) && args[0].kind == IMM_OPND && args[1].kind == IMM_OPND &&
+            fold(ins->code, args[0].val, args[1].val, &res)) {
+
+            if (res) {
+                ins->code = BRA_SYM;
+                ins->args += 2;
+                ins->argc = 1;
+            } else {
+                ctx->removed[i] = 1;
+            }
+
+            ctx->folded++;
+            continue;
+        }
+
+        if (!writes_local(ins->code)) {
+            continue;
+        }
+
+        if (ins->argc == 3 && args[1].kind == IMM_OPND && args[2].kind == IMM_OPND &&
+            fold(ins->code, args[1].val, args[2].val, &res)) {
+
+            ins->code = SET_SYM;
+            ins->argc = 2;
+            args[1].val = res;
+            ctx->folded++;
+        }
+
+        if (!is_scalar(ctx, &args[0])) {
+            //an array element; only its index is read
+            propagate_operand(ctx, &args[0]);
+            continue;
+        }
+
+        forget_local(ctx, args[0].val);
+
+        if (ins->code == SET_SYM) {
+            if (args[1].kind == IMM_OPND) {
+                ctx->info[args[0].val].known = 1;
+                ctx->info[args[0].val].val = args[1].val;
+            } else if (is_scalar(ctx, &args[1]) && args[1].val != args[0].val) {
+                ctx->info[args[0].val].copy = args[1].val;
+            }
+        }
+    }
+}
+
+/* removes the instructions that can't be reached from the start of the
+ * program, e.g. the ones after a RETURN or a BRA that aren't labeled */
+void remove_unreachable(opt_ctx_s *ctx)
+{
+    bytecode_image_s *img = ctx->img;
+    unsigned char *reached;
+    size_t *stack, top = 0;
+
+    ENO(reached = calloc(img->len + 1, sizeof(unsigned char)));
+    ENO(stack = malloc(sizeof(size_t) * (2 * img->len + 1)));
+
+    if (img->len) {
+        stack[top++] = 0;
+        reached[0] = 1;
+    }
+
+    while (top) {
+        size_t i = stack[--top], next[2];
+        const bytecode_s *ins = &img->code[i];
+        const operand_s *args = &img->opnds[ins->args];
+        unsigned int next_cnt = 0;
+
+        if (ctx->removed[i]) {
+            next[next_cnt++] = i + 1;
+        } else if (ins->code == BRA_SYM) {
+            next[next_cnt++] = (size_t)args[0].val;
+        } else if (is_branch(ins->code)) {
+            next[next_cnt++] = (size_t)args[2].val;
+            next[next_cnt++] = i + 1;
+        } else if (ins->code != RETURN_SYM) {
+            next[next_cnt++] = i + 1;
+        }
+
+        for (unsigned int j = 0; j < next_cnt; j++) {
+            if (next[j] < img->len && !reached[next[j]]) {
+                reached[next[j]] = 1;
+                stack[top++] = next[j];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < img->len; i++) {
+        if (!reached[i]) {
+            ctx->removed[i] = 1;
+        }
+    }
+
+    free(stack);
+    free(reached);
+}
+
+void count_reads(opt_ctx_s *ctx, const operand_s *op, int is_dest)
+{
+    if (is_scalar(ctx, op)) {
+        if (!is_dest) {
+            ctx->reads[op->val]++;
+        }
+    } else if (op->idx >= 0) {
+        count_reads(ctx, &ctx->img->opnds[op->idx], 0);
+    }
+}
+
+/* removes the instructions that only compute a value for a local that's
+ * never read. Only instructions that can't fail at run time are removed.
+ * Returns 1 if any instruction was removed */
+int remove_dead_stores(opt_ctx_s *ctx)
+{
+    bytecode_image_s *img = ctx->img;
+    int changed = 0;
+
+    memset(ctx->reads, 0, sizeof(unsigned int) * (img->local_cnt + 1));
+
+    for (size_t i = 0; i < img->len; i++) {
+        const bytecode_s *ins = &img->code[i];
+
+        if (!ctx->removed[i]) {
+            for (unsigned int j = 0; j < ins->argc; j++) {
+                count_reads(ctx, &img->opnds[ins->args + j], !j && writes_local(ins->code));
+            }
+        }
+    }
+
+    for (size_t i = 0; i < img->len; i++) {
+        const bytecode_s *ins = &img->code[i];
+        const operand_s *args = &img->opnds[ins->args];
+        int pure = 1;
+
+        //the atomic instructions change a global, even if their result isn't read
+        if (ctx->removed[i] || ins->code == LOAD_SYM || ins->code == FADD_SYM ||
+            ins->code == SWAP_SYM || ins->code == CAS_SYM || !writes_local(ins->code) ||
+            !is_scalar(ctx, &args[0]) || ctx->reads[args[0].val]) {
+            continue;
+        }
+
+        for (unsigned int j = 1; j < ins->argc; j++) {
+            if (args[j].kind != IMM_OPND && args[j].kind != ARGC_OPND && !is_scalar(ctx, &args[j])) {
+                pure = 0;
+            }
+        }
+
+        if ((ins->code == DIV_SYM || ins->code == MOD_SYM) &&
+            (args[2].kind != IMM_OPND || !args[2].val || args[2].val == -1)) {
+            pure = 0;
+        }
+
+        if (pure) {
+            ctx->removed[i] = 1;
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+/* moves the remaining instructions together, and points every label to
+ * the first remaining instruction at or after the one it used to point to */
+size_t compact_code(opt_ctx_s *ctx)
+{
+    bytecode_image_s *img = ctx->img;
+    size_t *new_idx, len = 0, removed;
+
+    ENO(new_idx = malloc(sizeof(size_t) * (img->len + 1)));
+
+    for (size_t i = 0; i < img->len; i++) {
+        new_idx[i] = len;
+
+        if (!ctx->removed[i]) {
+            img->code[len++] = img->code[i];
+        }
+    }
+
+    new_idx[img->len] = len;
+
+    for (size_t i = 0; i < img->opnd_len; i++) {
+        if (img->opnds[i].kind == LABEL_OPND) {
+            img->opnds[i].val = (int)new_idx[img->opnds[i].val];
+        }
+    }
+
+    removed = img->len - len;
+    img->len = len;
+
+    free(new_idx);
+
+    return removed;
+}
+
+/* a small optimizer that runs on every image after it's compiled. It folds
+ * instructions on known values, propagates copies of locals, and removes
+ * unreachable code and writes to locals that are never read */
+void optimize_image(program_s *prog, bytecode_image_s *img)
+{
+    opt_ctx_s ctx;
+    size_t removed;
+
+    ctx.img = img;
+    ctx.touched_cnt = 0;
+    ctx.folded = 0;
+
+    ctx.is_array = bytecode_array_locals(img);
+    ENO(ctx.leader = calloc(img->len + 1, sizeof(unsigned char)));
+    ENO(ctx.removed = calloc(img->len + 1, sizeof(unsigned char)));
+    ENO(ctx.info = malloc(sizeof(local_info_s) * (img->local_cnt + 1)));
+    ENO(ctx.touched = malloc(sizeof(int) * (img->len + 1)));
+    ENO(ctx.reads = malloc(sizeof(unsigned int) * (img->local_cnt + 1)));
+
+    for (size_t i = 0; i < img->local_cnt; i++) {
+        ctx.info[i].known = 0;
+        ctx.info[i].copy = -1;
+    }
+
+    for (size_t i = 0; i < img->opnd_len; i++) {
+        if (img->opnds[i].kind == LABEL_OPND) {
+            ctx.leader[img->opnds[i].val] = 1;
+        }
+    }
+
+    ctx.leader[0] = 1;
+
+    for (size_t i = 0; i < img->len; i++) {
+        instruction_id_e code = img->code[i].code;
+
+        if (code == BRA_SYM || code == RETURN_SYM || is_branch(code)) {
+            ctx.leader[i + 1] = 1;
+        }
+    }
+
+    propagate_constants(&ctx);
+    remove_unreachable(&ctx);
+
+    while (remove_dead_stores(&ctx))
+        ;
+
+    removed = compact_code(&ctx);
+
+    dbg_msg(prog, "optimizer folded %zu instructions and removed %zu", ctx.folded, removed);
+
+    free(ctx.is_array);
+    free(ctx.leader);
+    free(ctx.removed);
+    free(ctx.info);
+    free(ctx.touched);
+    free(ctx.reads);
+}
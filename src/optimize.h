@@ -0,0 +1,11 @@
+#ifndef SIMBLY_OPTIMIZE_H__
+#define SIMBLY_OPTIMIZE_H__
+
+#include "common.h"
+#include "program.h"
+#include "bytecode.h"
+
+
+void optimize_image(program_s *prog, bytecode_image_s *img);
+
+#endif //SIMBLY_OPTIMIZE_H__
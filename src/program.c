@@ -2,13 +2,15 @@
 #include "exec.h"
 #include "error.h"
 #include "scanner.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "aot.h"
 
 
 static int id_cnt = 1;
 static pthread_mutex_t id_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 
-static void free_keyval_token(void *p);
 static int generate_program_id(void);
 
 
@@ -35,17 +37,18 @@ int symbol_name_cmp(const void *name1, const void *name2)
     return 1;
 }
 
-void free_keyval_token(void *p)
+char *symbol_name_dup(const char *name, size_t len)
 {
-    KeyValuePair item = *(KeyValuePair*)p;
+    char *dup;
 
-    free(item.pKey);
-    free(item.pData);
+    ENO(dup = malloc(sizeof(char) * len));
+    memcpy(dup, name, len);
+
+    return dup;
 }
 
-program_s *program_init(char *fname, int argc, int *argv)
+program_s *program_init(char *fname, int argc, int *argv, unsigned int opts)
 {
-    vdsErrCode verr;
     program_s *p = NULL;
     size_t fname_len;
     int argv_len;
@@ -53,33 +56,84 @@ program_s *program_init(char *fname, int argc, int *argv)
     if (fname && (argc >= 0)) {
 
         ENO(p = malloc(sizeof(program_s)));
-        ENO(p->fd = fopen(fname, "r"));
+
+        arena_init(&p->arena);
+        arena_init(&p->scratch);
 
         argv_len = argc + 2;
 
-        ENO(p->argv = malloc(sizeof(int) * argv_len));
+        p->argv = (int*)arena_alloc(&p->arena, sizeof(int) * argv_len);
 
         fname_len = strlen(fname) + 1;
 
-        ENO(p->fname = malloc(sizeof(char) * fname_len));
+        p->fname = arena_strdup(&p->arena, fname, fname_len);
 
-        strcpy(p->fname, fname);
-
-        p->argv[0] = generate_program_id();
+        p->argv[0] = (opts & PROGRAM_OPT_COMPILE_ONLY) ? 0 : generate_program_id();
         p->argv[1] = argc;
 
         for (int i = 2; i < argc + 2; i++) {
             p->argv[i] = argv[i - 2];
         }
 
-        VDS(p->vartable = QuadHash_init(DEFAULT_VARTABLE_LEN, symbol_name_cmp, NULL, &verr), verr);
-        VDS(p->translated_line = RingBuffer_init(DEFAULT_TRANSLATED_LINE_LEN, &verr), verr);
+        p->src = p->word = NULL;
+        p->src_len = p->src_pos = p->word_len = 0;
+        p->translated_line = NULL;
 
         p->prev_col = 0;
         p->line = p->column = 1;
         p->state = MAGIC_LINE;
 
         p->error_flag = 0;
+        p->sem = NULL;
+        p->blocked_idx = 0;
+        p->sem_taken = 0;
+        p->next_waiter = NULL;
+        p->rt = p->rt_node = NULL;
+        p->parked = p->wake_pending = 0;
+        p->sleep_pos = 0;
+        p->opts = opts;
+        p->pc = 0;
+        p->locals = NULL;
+        p->jit = NULL;
+        p->aot = NULL;
+
+        p->image = (void*)bytecode_load(p);
+
+        if (p->image) {
+            bytecode_image_s *img = (bytecode_image_s*)p->image;
+
+            if (img->local_cnt) {
+                p->locals = (local_var_s*)arena_alloc(&p->arena, sizeof(local_var_s) * img->local_cnt);
+
+                for (size_t i = 0; i < img->local_cnt; i++) {
+                    p->locals[i].val = 0;
+                    int_array_init(&p->locals[i].arr, 0, &p->arena);
+                }
+
+                //the elements that are accessed without checks have to exist
+                for (size_t i = 0; i < img->opnd_len; i++) {
+                    const operand_s *op = &img->opnds[i];
+
+                    if (op->kind == LOCAL_ELEM_OPND && img->opnds[op->idx].val) {
+                        (void)int_array_elem(&p->locals[op->val].arr, (size_t)img->opnds[op->idx].val);
+                    }
+                }
+            }
+
+            if (!(opts & (PROGRAM_OPT_NO_AOT | PROGRAM_OPT_COMPILE_ONLY))) {
+                p->aot = (void*)aot_load(p);
+            }
+
+            if (!p->aot && (opts & PROGRAM_OPT_JIT)) {
+                p->jit = (void*)jit_init(p, (opts & PROGRAM_OPT_NO_FUSION) ? img->code : img->fused);
+            }
+
+            if (img->len) {
+                p->state = INSTRUCTION_LINE;
+            } else {
+                program_stop(p, 0);
+            }
+        }
     }
 
     return p;
@@ -97,12 +151,13 @@ void program_stop(program_s *p, int err)
 void program_free(program_s *p)
 {
     if (p) {
-        QuadHash_destroy(&p->vartable, free_keyval_token, NULL);
-        RingBuffer_destroy(&p->translated_line, free_token, NULL);
+        aot_free((aot_s*)p->aot);
+        jit_free((jit_s*)p->jit);
+        bytecode_release((bytecode_image_s*)p->image);
 
-        fclose(p->fd);
-        free(p->argv);
-        free(p->fname);
+        //the locals, their arrays, argv and the name of the file
+        arena_destroy(&p->arena);
+        arena_destroy(&p->scratch);
         free(p);
     }
 }
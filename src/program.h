@@ -2,11 +2,18 @@
 #define SIMBLY_PROGRAM_H__
 
 #include "common.h"
+#include "array.h"
+#include "arena.h"
 
 
-#define DEFAULT_VARTABLE_LEN 8
 #define DEFAULT_TRANSLATED_LINE_LEN 8
 
+/* options of the run command */
+#define PROGRAM_OPT_NO_FUSION 0x1 //run the instructions as they are, without superinstructions
+#define PROGRAM_OPT_JIT 0x2 //compile hot loops to native code
+#define PROGRAM_OPT_NO_AOT 0x4 //interpret the program even if its source was compiled to a shared object
+#define PROGRAM_OPT_COMPILE_ONLY 0x8 //only load the image of the program, which never runs and gets no ID
+
 typedef enum _program_state_e {
     MAGIC_LINE,
     INSTRUCTION_LINE,
@@ -16,26 +23,49 @@ typedef enum _program_state_e {
     FINISHED
 } program_state_e;
 
+/* an entry of the register file of a program. Every local is an array,
+ * with scalars being arrays of length 1. Element 0 is always stored in
+ * val, so that scalars never need a separate allocation */
+typedef struct _local_var_s {
+    int val;
+    int_array_s arr; //the rest of the elements; the first element of arr isn't used
+} local_var_s;
+
 typedef struct _program_s {
-    FILE *fd;
-    char input[MAX_INPUT_STR_LEN + 1], *fname;
+    const char *src, *word; //the mapped source file and the last word read from it
+    size_t src_len, src_pos, word_len;
+    char *fname;
     unsigned int line, column, prev_col;
-    QuadHashtable *vartable;
-    struct timespec sleep_left;
+    local_var_s *locals;
+    struct timespec wake_time; //when a sleeping program can run again, on CLOCK_MONOTONIC
+    size_t sleep_pos; //the position of a sleeping program in the sleep heap of its runtime
     int *argv, c;
     program_state_e state;
     RingBuffer *translated_line;
+    void *image;
+    void *jit;
+    void *aot;
+    unsigned int opts;
+    size_t pc;
     int error_flag;
-    void *sem;
+    void *sem; //the global that the program is blocked on
     size_t blocked_idx;
+    int sem_taken; //sem was taken for the program when it was woken, and the program hasn't run since
+    struct _program_s *next_waiter; //the program queued after this one, on the same element of sem
+    void *rt; //the runtime that the program is attached to
+    void *rt_node; //the node of the program in the program list or the parked list of rt
+    int parked, wake_pending;
+    arena_s arena; //everything that lives as long as the program is allocated from this
+    arena_s scratch; //the tokens and symbols of the compiler, which are released after compiling
 } program_s;
 
 
-program_s *program_init(char *fname, int argc, int *argv);
+program_s *program_init(char *fname, int argc, int *argv, unsigned int opts);
 void program_free(program_s *p);
 void program_stop(program_s *p, int err);
 void print_program_state(program_s *p);
 int symbol_name_cmp(const void *name1, const void *name2);
+char *symbol_name_dup(const char *name, size_t len);
 void clear_translated_line(program_s *p);
 
 #endif //SIMBLY_PROGRAM_H__
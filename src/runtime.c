@@ -1,5 +1,6 @@
 #include "runtime.h"
 #include "exec.h"
+#include "aot.h"
 #include "global.h"
 #include "error.h"
 
@@ -7,7 +8,19 @@
 //an instruction line normally takes about 10000000 nanoseconds to execute
 #define TIME_SLICE_MAX_NSEC 10000000
 
+//number of instructions executed between two checks of the time slice
+#define INSTRUCTION_BATCH_LEN 128
+
+//initial capacity of the sleep heap of a runtime
+#define SLEEP_HEAP_INIT_LEN 8
+
 static void *runtime_thread(void *param);
+static void runtime_unpark(runtime_s *rt, program_s *prog);
+static int time_before(const struct timespec *a, const struct timespec *b);
+static void sleep_heap_place(runtime_s *rt, program_s *prog, size_t pos);
+static void sleep_heap_push(runtime_s *rt, program_s *prog);
+static program_s *sleep_heap_remove(runtime_s *rt, size_t pos);
+static void runtime_wake_sleepers(runtime_s *rt);
 static void prog_free_cb(void *data);
 
 
@@ -16,12 +29,25 @@ void *runtime_thread(void *param)
     runtime_s *rt = (runtime_s*)param;
     struct timespec start_time, end_time;
     long int diff, time_slice;
+    vdsErrCode verr;
 
     while (rt->running) {
         PTH(pthread_mutex_lock(&rt->lock));
 
+        runtime_wake_sleepers(rt);
+
+        //with only sleeping programs left, the thread waits until the first one can run
         while (rt->running && !rt->program_list) {
-            PTH(pthread_cond_wait(&rt->list_not_empty, &rt->lock));
+            if (rt->sleeper_cnt) {
+                int err = pthread_cond_timedwait(&rt->list_not_empty, &rt->lock, &rt->sleepers[0]->wake_time);
+
+                if (err != ETIMEDOUT) {
+                    PTH(err);
+                }
+                runtime_wake_sleepers(rt);
+            } else {
+                PTH(pthread_cond_wait(&rt->list_not_empty, &rt->lock));
+            }
         }
 
         rt->curr = rt->program_list;
@@ -56,13 +82,21 @@ void *runtime_thread(void *param)
             switch (prog->state) {
                 case MAGIC_LINE:
                 case INSTRUCTION_LINE:
+                    //a program that was woken has now used the semaphore that was taken for it
+                    prog->sem_taken = 0;
 
                     //printf("\nProgram %d is being executed!\n", prog->argv[0]);
                     do {
 
                         ENO(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_time));
 
-                        interpret_next_line(prog);
+                        //compiled programs return after the same number of
+                        //instructions, so that they're preempted like the rest
+                        if (prog->aot) {
+                            (void)aot_next_lines(prog, INSTRUCTION_BATCH_LEN);
+                        } else {
+                            (void)interpret_next_lines(prog, INSTRUCTION_BATCH_LEN);
+                        }
 
                         ENO(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end_time));
 
@@ -87,36 +121,6 @@ void *runtime_thread(void *param)
                     } while ((time_slice > 0) && (prog->state == INSTRUCTION_LINE));
 
                     break;
-                case SLEEPING:
-                    diff = prog->sleep_left.tv_nsec - time_slice;
-
-                    if (diff < 0) {
-
-                        if (!prog->sleep_left.tv_sec) {
-
-                            ENO(nanosleep(&prog->sleep_left, NULL));
-                            prog->state = INSTRUCTION_LINE;
-
-                        } else {
-
-                            prog->sleep_left.tv_sec--;
-                            prog->sleep_left.tv_nsec = diff + 1000000000;
-                            //using start_time as a temp value here
-                            start_time.tv_sec = 0;
-                            start_time.tv_nsec = time_slice;
-                            ENO(nanosleep(&start_time, NULL));
-                        }
-
-                    } else {
-                        prog->sleep_left.tv_nsec = diff;
-
-                        start_time.tv_sec = 0;
-                        start_time.tv_nsec = time_slice;
-                        ENO(nanosleep(&start_time, NULL));
-                    }
-                    break;
-                case BLOCKED:
-                    program_state_blocked(prog, time_slice);
                 default:
                     break;
             }
@@ -129,25 +133,51 @@ void *runtime_thread(void *param)
                     shell_msg("Program %d finished", prog->argv[0]);
                 pthread_mutex_unlock(&print_lock);
 
+                //a program that's killed while it's blocked is still queued on the semaphore
+                global_var_cancel(prog);
+
                 PTH(pthread_mutex_lock(&rt->lock));
                 rt->curr = rt->curr->nxt;
 
                 rt->program_cnt--;
                 CDLList_deleteNode(&rt->program_list, rt->curr->prv, NULL);
                 program_free(prog);
-                PTH(pthread_mutex_unlock(&rt->lock));
+            } else if (prog->state == BLOCKED) {
+                PTH(pthread_mutex_lock(&rt->lock));
 
-                if (!rt->program_list) {
-                    rt->curr = NULL;
+                //the semaphore may have been raised while the program was still running
+                if (prog->wake_pending) {
+                    prog->wake_pending = 0;
+                    prog->state = INSTRUCTION_LINE;
+                    rt->curr = rt->curr->nxt;
+                } else {
+                    rt->curr = rt->curr->nxt;
+
+                    CDLList_deleteNode(&rt->program_list, rt->curr->prv, NULL);
+                    VDS(prog->rt_node = CDLList_append(&rt->parked_list, (void*)prog, &verr), verr);
+                    prog->parked = 1;
                 }
+            } else if (prog->state == SLEEPING) {
+                PTH(pthread_mutex_lock(&rt->lock));
+                rt->curr = rt->curr->nxt;
+
+                CDLList_deleteNode(&rt->program_list, rt->curr->prv, NULL);
+                prog->rt_node = NULL;
+                sleep_heap_push(rt, prog);
             } else {
                 /* only reason for locking here is to make the 'list' command work
                  * properly. without the 'list' command, this locking can be removed */
                 PTH(pthread_mutex_lock(&rt->lock));
                 rt->curr = rt->curr->nxt;
-                PTH(pthread_mutex_unlock(&rt->lock));
             }
 
+            if (!rt->program_list) {
+                rt->curr = NULL;
+            }
+
+            //programs that wake up are appended, and run when the list comes around to them
+            runtime_wake_sleepers(rt);
+            PTH(pthread_mutex_unlock(&rt->lock));
         }
     }
 
@@ -159,6 +189,7 @@ runtime_s *runtime_init(void)
     vdsErrCode verr;
     runtime_s *rt;
     pthread_mutexattr_t attr;
+    pthread_condattr_t cond_attr;
 
     ENO(rt = malloc(sizeof(runtime_s)));
 
@@ -166,14 +197,22 @@ runtime_s *runtime_init(void)
     PTH(pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK));
     PTH(pthread_mutex_init(&rt->lock, &attr));
     PTH(pthread_mutexattr_destroy(&attr));
-    PTH(pthread_cond_init(&rt->list_not_empty, NULL));
+    //the thread waits on it until the first sleeping program can run
+    PTH(pthread_condattr_init(&cond_attr));
+    PTH(pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC));
+    PTH(pthread_cond_init(&rt->list_not_empty, &cond_attr));
+    PTH(pthread_condattr_destroy(&cond_attr));
 
     VDS(rt->rand_generator = RandomState_init((unsigned int)time(NULL), &verr), verr);
 
-    rt->program_list = rt->curr = NULL;
+    rt->program_list = rt->curr = rt->parked_list = NULL;
     rt->program_cnt = 0;
     rt->running = 1;
 
+    ENO(rt->sleepers = malloc(sizeof(program_s*) * SLEEP_HEAP_INIT_LEN));
+    rt->sleeper_cnt = 0;
+    rt->sleeper_cap = SLEEP_HEAP_INIT_LEN;
+
     PTH(pthread_create(&rt->thrd_id, NULL, runtime_thread, (void*)rt));
 
     return rt;
@@ -187,7 +226,8 @@ void runtime_attach_program(runtime_s *rt, program_s *prog)
         pthread_mutex_lock(&rt->lock);
 
         rt->program_cnt++;
-        VDS(CDLList_append(&rt->program_list, (void*)prog, &err), err);
+        VDS(prog->rt_node = CDLList_append(&rt->program_list, (void*)prog, &err), err);
+        prog->rt = (void*)rt;
 
         //if the list was empty before we added this program, there's a chance
         //that the interpreter thread will be sleeping on the condition, so we
@@ -199,10 +239,194 @@ void runtime_attach_program(runtime_s *rt, program_s *prog)
     }
 }
 
+/* moves a parked program back to the program list. The lock of the runtime has to be held */
+void runtime_unpark(runtime_s *rt, program_s *prog)
+{
+    vdsErrCode err;
+
+    CDLList_deleteNode(&rt->parked_list, (CDLListNode*)prog->rt_node, NULL);
+    VDS(prog->rt_node = CDLList_append(&rt->program_list, (void*)prog, &err), err);
+    prog->parked = 0;
+
+    if (rt->program_list->nxt == rt->program_list) {
+        pthread_cond_signal(&rt->list_not_empty);
+    }
+}
+
+int time_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* stores a program at a position of the sleep heap, after moving it up or
+ * down to where its wake time belongs */
+void sleep_heap_place(runtime_s *rt, program_s *prog, size_t pos)
+{
+    program_s **heap = rt->sleepers;
+
+    while (pos && time_before(&prog->wake_time, &heap[(pos - 1) / 2]->wake_time)) {
+        heap[pos] = heap[(pos - 1) / 2];
+        heap[pos]->sleep_pos = pos;
+        pos = (pos - 1) / 2;
+    }
+
+    for (size_t child = 2 * pos + 1; child < rt->sleeper_cnt; child = 2 * pos + 1) {
+        if (child + 1 < rt->sleeper_cnt && time_before(&heap[child + 1]->wake_time, &heap[child]->wake_time)) {
+            child++;
+        }
+
+        if (!time_before(&heap[child]->wake_time, &prog->wake_time)) {
+            break;
+        }
+
+        heap[pos] = heap[child];
+        heap[pos]->sleep_pos = pos;
+        pos = child;
+    }
+
+    heap[pos] = prog;
+    prog->sleep_pos = pos;
+}
+
+void sleep_heap_push(runtime_s *rt, program_s *prog)
+{
+    if (rt->sleeper_cnt == rt->sleeper_cap) {
+        rt->sleeper_cap *= 2;
+        ENO(rt->sleepers = realloc(rt->sleepers, sizeof(program_s*) * rt->sleeper_cap));
+    }
+
+    rt->sleeper_cnt++;
+    sleep_heap_place(rt, prog, rt->sleeper_cnt - 1);
+}
+
+//takes the program at a position out of the sleep heap
+program_s *sleep_heap_remove(runtime_s *rt, size_t pos)
+{
+    program_s *prog = rt->sleepers[pos];
+
+    rt->sleeper_cnt--;
+
+    if (pos < rt->sleeper_cnt) {
+        sleep_heap_place(rt, rt->sleepers[rt->sleeper_cnt], pos);
+    }
+
+    return prog;
+}
+
+/* moves the sleeping programs that can run again to the program list. The
+ * lock of the runtime has to be held */
+void runtime_wake_sleepers(runtime_s *rt)
+{
+    struct timespec now;
+    vdsErrCode err;
+
+    if (!rt->sleeper_cnt) {
+        return;
+    }
+
+    ENO(clock_gettime(CLOCK_MONOTONIC, &now));
+
+    while (rt->sleeper_cnt && !time_before(&now, &rt->sleepers[0]->wake_time)) {
+        program_s *prog = sleep_heap_remove(rt, 0);
+
+        prog->state = INSTRUCTION_LINE;
+        VDS(prog->rt_node = CDLList_append(&rt->program_list, (void*)prog, &err), err);
+    }
+}
+
+/* makes a program that was blocked on a semaphore runnable again, after the
+ * semaphore was taken for it. Returns 0 if the program was killed instead,
+ * which is only checked with the lock of the runtime held, like it's set */
+int runtime_wake_program(program_s *prog)
+{
+    runtime_s *rt = (runtime_s*)prog->rt;
+
+    PTH(pthread_mutex_lock(&rt->lock));
+
+    if (prog->error_flag) {
+        PTH(pthread_mutex_unlock(&rt->lock));
+        return 0;
+    }
+
+    prog->sem_taken = 1;
+
+    if (prog->parked) {
+        prog->state = INSTRUCTION_LINE;
+        runtime_unpark(rt, prog);
+    } else {
+        //the runtime hasn't parked it yet, and will see this instead
+        prog->wake_pending = 1;
+    }
+
+    PTH(pthread_mutex_unlock(&rt->lock));
+
+    return 1;
+}
+
+/* stops the program with the given ID, if it's attached to the runtime. A
+ * parked or sleeping program is moved back to the program list, where the
+ * runtime will see that it's stopped and free it */
+int runtime_kill_program(runtime_s *rt, int id)
+{
+    CDLListNode *lists[2];
+    int found = 0;
+
+    PTH(pthread_mutex_lock(&rt->lock));
+
+    lists[0] = rt->program_list;
+    lists[1] = rt->parked_list;
+
+    for (size_t i = 0; i < ARRAY_LEN(lists) && !found; i++) {
+        CDLListNode *curr = lists[i];
+
+        if (curr) {
+            do {
+                program_s *prog = (program_s*)curr->pData;
+
+                if (prog->argv[0] == id) {
+                    program_stop(prog, 1);
+
+                    if (prog->parked) {
+                        runtime_unpark(rt, prog);
+                    }
+
+                    found = 1;
+                    break;
+                }
+                curr = curr->nxt;
+            } while (curr != lists[i]);
+        }
+    }
+
+    for (size_t i = 0; i < rt->sleeper_cnt && !found; i++) {
+        program_s *prog = rt->sleepers[i];
+
+        if (prog->argv[0] == id) {
+            vdsErrCode err;
+
+            program_stop(prog, 1);
+            (void)sleep_heap_remove(rt, i);
+            VDS(prog->rt_node = CDLList_append(&rt->program_list, (void*)prog, &err), err);
+
+            //the runtime may be waiting for its first sleeping program to wake up
+            if (rt->program_list->nxt == rt->program_list) {
+                pthread_cond_signal(&rt->list_not_empty);
+            }
+
+            found = 1;
+        }
+    }
+
+    PTH(pthread_mutex_unlock(&rt->lock));
+
+    return found;
+}
+
 void prog_free_cb(void *data)
 {
     program_s *p = (program_s *)data;
 
+    global_var_cancel(p);
     program_free(p);
 }
 
@@ -219,7 +443,35 @@ void runtime_stop(runtime_s *rt)
 
         PTH(pthread_join(rt->thrd_id, NULL));
 
+        /* parked programs can be woken by the programs of other runtimes until
+         * they're taken off the queues of their semaphores. Once they are,
+         * they're freed with the rest */
+        PTH(pthread_mutex_lock(&rt->lock));
+
+        while (rt->parked_list) {
+            program_s *prog = (program_s*)rt->parked_list->pData;
+
+            PTH(pthread_mutex_unlock(&rt->lock));
+            global_var_cancel(prog);
+            PTH(pthread_mutex_lock(&rt->lock));
+
+            if (prog->parked) {
+                runtime_unpark(rt, prog);
+            }
+        }
+
+        //sleeping programs aren't on any queue
+        while (rt->sleeper_cnt) {
+            vdsErrCode err;
+            program_s *prog = sleep_heap_remove(rt, rt->sleeper_cnt - 1);
+
+            VDS(prog->rt_node = CDLList_append(&rt->program_list, (void*)prog, &err), err);
+        }
+
+        PTH(pthread_mutex_unlock(&rt->lock));
+
         CDLList_destroy(&rt->program_list, prog_free_cb, NULL);
+        free(rt->sleepers);
         RandomState_destroy(&rt->rand_generator, NULL);
         pthread_cond_destroy(&rt->list_not_empty);
         pthread_mutex_destroy(&rt->lock);
@@ -6,6 +6,9 @@
 
 typedef struct _runtime_s {
     CDLListNode *program_list, *curr;
+    CDLListNode *parked_list; //programs blocked on a semaphore, which aren't run until they're woken
+    program_s **sleepers; //a min-heap of the sleeping programs, ordered by when they can run again
+    size_t sleeper_cnt, sleeper_cap;
     pthread_t thrd_id;
     pthread_mutex_t lock;
     pthread_cond_t list_not_empty;
@@ -16,6 +19,8 @@ typedef struct _runtime_s {
 
 runtime_s *runtime_init(void);
 void runtime_attach_program(runtime_s *rt, program_s *prog);
+int runtime_wake_program(program_s *prog);
+int runtime_kill_program(runtime_s *rt, int id);
 void runtime_stop(runtime_s *rt);
 
 #endif //SIMBLY_RUNTIME_H__
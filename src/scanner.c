@@ -1,6 +1,10 @@
 #include "scanner.h"
 #include "exec.h"
 #include "error.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define LOCAL_VAR_TYPE 0
 #define GLOBAL_VAR_TYPE 1
@@ -15,7 +19,7 @@ do { \
 
 #define NEXT_CHAR(prog) \
 do { \
-    prog->c = fgetc(prog->fd); \
+    prog->c = (prog->src_pos < prog->src_len) ? (unsigned char)prog->src[prog->src_pos++] : EOF; \
 \
     if (prog->c == '\n') { \
         NEXT_LINE(prog); \
@@ -24,12 +28,16 @@ do { \
     } \
 } while (0)
 
+/* words are slices of the source that aren't NUL terminated; reading
+ * past the end of the word gives 0, as if it was a C string */
+#define WORD_CHAR(prog, i) (((i) < prog->word_len) ? prog->word[i] : '\0')
+
 
 
 static int flush_up_to_char(program_s *prog);
 static int flush_up_to_newline(program_s *prog);
 static size_t get_next_word(program_s *prog, size_t max_len, int this_line);
-static void add_new_token(program_s *prog, void *ptr, int value,
+static void add_new_token(program_s *prog, const void *ptr, int value,
                           size_t data_len, token_type_e tok, instruction_id_e code);
 
 static void loadstore_handler(program_s *prog, instruction_id_e ins_code);
@@ -40,35 +48,22 @@ static void semaphore_handler(program_s *prog, instruction_id_e ins_code);
 static void sleep_handler(program_s *prog, instruction_id_e ins_code);
 static void print_handler(program_s *prog, instruction_id_e ins_code);
 static void return_handler(program_s *prog, instruction_id_e ins_code);
+static void vector_handler(program_s *prog, instruction_id_e ins_code);
+static void atomic_handler(program_s *prog, instruction_id_e ins_code);
 
-static void free_int_arr_tok(int_arr_tok_s *arr_tok);
+static void free_int_arr_tok(program_s *prog, int_arr_tok_s *arr_tok);
 static int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
-                              varval_u *tok_data, int is_array_idx, unsigned int *depth);
+                              varval_u *tok_data, size_t *tok_len, int is_array_idx,
+                              unsigned int *depth);
+
 
 
+#define INSTRUCTION_ENTRY(name, handler) {#name, name##_SYM, handler},
 
 /* string array can be used as a hashtable with "hashes"
  * from the instruction_id_e enum that map on each instruction handler */
 static const instruction_s instruction_array[] = {
-    {"LOAD", LOAD_SYM, loadstore_handler},
-    {"STORE", STORE_SYM, loadstore_handler},
-    {"SET", SET_SYM, set_handler},
-    {"ADD", ADD_SYM, primitive_op_handler},
-    {"SUB", SUB_SYM, primitive_op_handler},
-    {"MUL", MUL_SYM, primitive_op_handler},
-    {"DIV", DIV_SYM, primitive_op_handler},
-    {"MOD", MOD_SYM, primitive_op_handler},
-    {"BRGT", BRGT_SYM, branch_handler},
-    {"BRGE", BRGE_SYM, branch_handler},
-    {"BRLT", BRLT_SYM, branch_handler},
-    {"BRLE", BRLE_SYM, branch_handler},
-    {"BREQ", BREQ_SYM, branch_handler},
-    {"BRA", BRA_SYM, branch_handler},
-    {"DOWN", DOWN_SYM, semaphore_handler},
-    {"UP", UP_SYM, semaphore_handler},
-    {"SLEEP", SLEEP_SYM, sleep_handler},
-    {"PRINT", PRINT_SYM, print_handler},
-    {"RETURN", RETURN_SYM, return_handler}
+    INSTRUCTION_LIST(INSTRUCTION_ENTRY)
 };
 
 static QuadHashtable *instruction_table;
@@ -114,6 +109,7 @@ size_t get_next_word(program_s *prog, size_t max_len, int this_line)
 
         size_t i = 0;
         unsigned int prev_line = prog->line;
+        const char *word;
 
         if (this_line && (prog->c == '\n')) {
             return 0;
@@ -129,15 +125,21 @@ size_t get_next_word(program_s *prog, size_t max_len, int this_line)
             return 0;
         }
 
-        prog->input[i++] = prog->c;
+        if (prog->c == EOF) {
+            return 0;
+        }
+
+        //the current character was the last one read from the source
+        word = &prog->src[prog->src_pos - 1];
+        i++;
 
         while (1) {
             NEXT_CHAR(prog);
 
             if (i == max_len) {
                 program_stop(prog, 1);
-                err_msg(prog, "symbol too big to parse; maximum symbol name length allowed is %zu\n\t%s...\n\t^",
-                        max_len, prog->input);
+                err_msg(prog, "symbol too big to parse; maximum symbol name length allowed is %zu\n\t%.*s...\n\t^",
+                        max_len, (int)i, word);
                 return 0;
             }
 
@@ -150,13 +152,13 @@ size_t get_next_word(program_s *prog, size_t max_len, int this_line)
                 break;
             }
 
-            prog->input[i++] = prog->c;
-
+            i++;
         }
 
-        prog->input[i] = 0;
+        prog->word = word;
+        prog->word_len = i;
 
-        dbg_msg(prog, "read word %s with length %zu", prog->input, i);
+        dbg_msg(prog, "read word %.*s with length %zu", (int)i, word, i);
 
         return i;
     }
@@ -168,9 +170,10 @@ size_t get_next_word(program_s *prog, size_t max_len, int this_line)
  * that might represent a varval rule. obviously the recursion only happens
  * when we have array indices */
 int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
-                       varval_u *tok_data, int is_array_idx, unsigned int *depth)
+                       varval_u *tok_data, size_t *tok_len, int is_array_idx,
+                       unsigned int *depth)
 {
-    size_t i;
+    size_t i, len = 0;
     int success = 0;
     varval_u ptr;
 
@@ -184,15 +187,15 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
             stop_character = ']';
         }
 
-        if (prog->input[start_idx] == '$') {
+        if (WORD_CHAR(prog, start_idx) == '$') {
 
-            if (isalpha(prog->input[start_idx + 1])) {
+            if (isalpha(WORD_CHAR(prog, start_idx + 1))) {
 
                 size_t symbol_limit = start_idx + 2 + MAX_ALLOWED_SYMBOL_LEN;
 
-                for (i = start_idx + 2; (prog->input[i] != stop_character) && (prog->input[i] != '['); i++) {
+                for (i = start_idx + 2; (WORD_CHAR(prog, i) != stop_character) && (WORD_CHAR(prog, i) != '['); i++) {
 
-                    if (!isalnum(prog->input[i])) {
+                    if (!isalnum(WORD_CHAR(prog, i))) {
                         program_stop(prog, 1);
                         err_msg(prog, "variable names always begin with a letter, followed by alphanumeric characters");
                         break;
@@ -206,39 +209,28 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
 
                 }
 
-                if (prog->input[i] == stop_character) {
+                if (WORD_CHAR(prog, i) == stop_character) {
 
                     if (type) {
                         *type = INT_VAR_TOK;
                     }
 
-                    size_t offset = i - start_idx;
-
                     success = 1;
-                    ptr.ptr = (void*)&prog->input[start_idx + 1];
+                    ptr.ptr = (void*)&prog->word[start_idx + 1];
+                    len = i - start_idx - 1;
 
                     if (!is_array_idx) {
-                        add_new_token(prog, ptr.ptr, 0, offset, INT_VAR_TOK, 0);
-                    } else {
-                        char *name;
-                        ENO(name = malloc(sizeof(char) * (offset + 1)));
-                        memcpy(name, ptr.ptr, offset - 1);
-                        name[offset - 1] = 0;
-                        ptr.ptr = name;
+                        add_new_token(prog, ptr.ptr, 0, len, INT_VAR_TOK, 0);
                     }
 
-                } else if (prog->input[i] == '[') {
+                } else if (WORD_CHAR(prog, i) == '[') {
 
                     int_arr_tok_s *arr;
-                    size_t len = i - start_idx;
 
-                    ENO(arr = malloc(sizeof(int_arr_tok_s)));
+                    arr = (int_arr_tok_s*)arena_alloc(&prog->scratch, sizeof(int_arr_tok_s));
 
-                    ENO(arr->name = malloc(sizeof(char) * len));
-
-                    strncpy(arr->name, &prog->input[start_idx + 1], len - 1);
-
-                    arr->name[len - 1] = 0;
+                    arr->name = &prog->word[start_idx + 1];
+                    arr->name_len = i - start_idx - 1;
 
                     if (type) {
                         *type = INT_ARR_TOK;
@@ -257,11 +249,11 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
                         unsigned int recur_depth = 1;
                         unsigned int closing_bracket_count = 0;
 
-                        if (!parse_varval_token(prog, i + 1, &arr->idx_type, &arr->idx, 1, &recur_depth))
+                        if (!parse_varval_token(prog, i + 1, &arr->idx_type, &arr->idx, &arr->idx_len, 1, &recur_depth))
                             return 0;
 
-                        for (size_t j = i + 1; prog->input[j]; j++) {
-                            if (prog->input[j] == ']')
+                        for (size_t j = i + 1; j < prog->word_len; j++) {
+                            if (prog->word[j] == ']')
                                 closing_bracket_count++;
                         }
 
@@ -277,7 +269,7 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
                             (*depth)++;
 
                         ptr.ptr = arr;
-                        success = parse_varval_token(prog, i + 1, &arr->idx_type, &arr->idx, 1, depth);
+                        success = parse_varval_token(prog, i + 1, &arr->idx_type, &arr->idx, &arr->idx_len, 1, depth);
                     }
 
                 } else if (is_array_idx) {
@@ -292,9 +284,9 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
                 err_msg(prog, "variable names always begin with a letter, followed by alphanumeric characters");
             }
 
-        } else if (prog->input[start_idx] == '-' || isdigit(prog->input[start_idx])) {
+        } else if (WORD_CHAR(prog, start_idx) == '-' || isdigit(WORD_CHAR(prog, start_idx))) {
 
-            if (is_array_idx && prog->input[start_idx] == '-') {
+            if (is_array_idx && WORD_CHAR(prog, start_idx) == '-') {
 
                 program_stop(prog, 1);
                 err_msg(prog, "invalid symbol detected inside array index brackets");
@@ -303,9 +295,9 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
 
                 size_t num_limit = MAX_INT_STR_LEN + start_idx;
 
-                for (i = start_idx + 1; prog->input[i] != stop_character; i++) {
+                for (i = start_idx + 1; WORD_CHAR(prog, i) != stop_character; i++) {
 
-                    if (!isdigit(prog->input[i])) {
+                    if (!isdigit(WORD_CHAR(prog, i))) {
                         program_stop(prog, 1);
                         err_msg(prog, "invalid characters detected while parsing number");
                         break;
@@ -319,9 +311,17 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
 
                 }
 
-                if (prog->input[i] == stop_character) {
+                if (WORD_CHAR(prog, i) == stop_character) {
+
+                    //the word isn't NUL terminated, so atoi() can't be used
+                    ptr.value = 0;
+                    for (size_t j = start_idx + (WORD_CHAR(prog, start_idx) == '-'); j < i; j++) {
+                        ptr.value = ptr.value * 10 + (prog->word[j] - '0');
+                    }
 
-                    ptr.value = atoi(&prog->input[start_idx]);
+                    if (WORD_CHAR(prog, start_idx) == '-') {
+                        ptr.value = -ptr.value;
+                    }
 
                     if (type) {
                         *type = INT_VAL_TOK;
@@ -341,7 +341,8 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
 
         } else {
             program_stop(prog, 1);
-            err_msg(prog, "unrecognized string isn't variable or integer value\n\t%s\n\t^", &prog->input[start_idx]);
+            err_msg(prog, "unrecognized string isn't variable or integer value\n\t%.*s\n\t^",
+                    (int)(prog->word_len - start_idx), &prog->word[start_idx]);
         }
     }
 
@@ -349,14 +350,17 @@ int parse_varval_token(program_s *prog, size_t start_idx, token_type_e *type,
         *tok_data = ptr;
     }
 
+    if (tok_len) {
+        *tok_len = len;
+    }
+
     return success;
 }
 
 void parse_magic(program_s *prog)
 {
     size_t i, len = ARRAY_LEN(magic_bytes);
-
-    ASRT(len <= ARRAY_LEN(prog->input));
+    char magic[ARRAY_LEN(magic_bytes)];
 
     for (i = 0; i < len; i++) {
         NEXT_CHAR(prog);
@@ -366,12 +370,12 @@ void parse_magic(program_s *prog)
             return;
         }
 
-        prog->input[i] = (char)prog->c;
+        magic[i] = (char)prog->c;
     }
 
-    prog->input[i - 1] = 0;
+    magic[i - 1] = 0;
 
-    if (strncmp(magic_bytes, prog->input, len)) {
+    if (strncmp(magic_bytes, magic, len)) {
         program_stop(prog, 1);
         err_msg(prog,
                 "not a valid simbly program; valid simbly programs begin with the magic bytes \"%s\"",
@@ -400,7 +404,9 @@ int is_valid_label(program_s *prog, size_t len)
 {
     if (prog && len) {
 
-        if (prog->input[0] == 'L' && strcmp(prog->input, "LOAD")) {
+        //the instructions that start with L can't be labels
+        if (prog->word[0] == 'L' && (len != 4 || memcmp(prog->word, "LOAD", 4)) &&
+            (len != 5 || memcmp(prog->word, "LOADN", 5))) {
 
             if (len == 1) {
                 program_stop(prog, 1);
@@ -409,7 +415,7 @@ int is_valid_label(program_s *prog, size_t len)
             }
 
             for (size_t i = 1; i < len; i++) {
-                if (!isalnum(prog->input[i])) {
+                if (!isalnum(prog->word[i])) {
                     program_stop(prog, 1);
                     err_msg(prog, "label names can only have alphanumeric characters");
                     return 0;
@@ -424,13 +430,15 @@ int is_valid_label(program_s *prog, size_t len)
     return 0;
 }
 
-void add_new_token(program_s *prog, void *ptr, int value,
+/* tokens with names or strings point to them in the source, instead of
+ * having their own copy; data_len is the length of the name or string */
+void add_new_token(program_s *prog, const void *ptr, int value,
                    size_t data_len, token_type_e tok, instruction_id_e code)
 {
     vdsErrCode verr;
     token_s *new_tok;
 
-    ENO(new_tok = malloc(sizeof(token_s)));
+    new_tok = (token_s*)arena_alloc(&prog->scratch, sizeof(token_s));
 
     new_tok->type = tok;
     new_tok->line = prog->line;
@@ -448,44 +456,32 @@ void add_new_token(program_s *prog, void *ptr, int value,
 
     } else {
 
-        if (data_len) {
-
-            new_tok->len = data_len;
-            ENO(new_tok->data.ptr = malloc(data_len));
-            memcpy(new_tok->data.ptr, ptr, data_len);
-
-        } else {
-
-            new_tok->data.ptr = ptr;
-            new_tok->len = 0;
-
-        }
+        new_tok->data.ptr = (void*)ptr;
+        new_tok->len = data_len;
 
     }
 
-    if (tok == LABEL_TOK) {
-        ENO(new_tok->offset = ftell(prog->fd));
-    }
-
     /* FOR DEBUGGING */
     switch (tok) {
         case INSTRUCTION_TOK:
-            dbg_msg(prog, "new instruction %s token recognized", prog->input);
+            dbg_msg(prog, "new instruction %.*s token recognized", (int)prog->word_len, prog->word);
             break;
         case LABEL_TOK:
-            dbg_msg(prog, "new label %s token recognized", (char*)new_tok->data.ptr);
+            dbg_msg(prog, "new label %.*s token recognized", (int)new_tok->len, (char*)new_tok->data.ptr);
             break;
         case INT_VAL_TOK:
             dbg_msg(prog, "new integer value %d token recognized", new_tok->data.value);
             break;
         case INT_VAR_TOK:
-            dbg_msg(prog, "new integer variable token with name %s recognized", (char*)new_tok->data.ptr);
+            dbg_msg(prog, "new integer variable token with name %.*s recognized",
+                    (int)new_tok->len, (char*)new_tok->data.ptr);
             break;
         case INT_ARR_TOK:
         {
             int_arr_tok_s *arr = (int_arr_tok_s*)new_tok->data.ptr;
 
-            dbg_msg(prog, "new integer array variable token with name %s recognized", arr->name);
+            dbg_msg(prog, "new integer array variable token with name %.*s recognized",
+                    (int)arr->name_len, arr->name);
             break;
         }
         default:
@@ -502,7 +498,7 @@ void add_new_token(program_s *prog, void *ptr, int value,
     }
 }
 
-void free_int_arr_tok(int_arr_tok_s *arr_tok)
+void free_int_arr_tok(program_s *prog, int_arr_tok_s *arr_tok)
 {
     if (arr_tok) {
         int_arr_tok_s *curr = arr_tok, *prev = NULL;
@@ -512,36 +508,27 @@ void free_int_arr_tok(int_arr_tok_s *arr_tok)
             if (curr->idx_type == INT_ARR_TOK) {
                 prev = curr;
                 curr = (int_arr_tok_s*)curr->idx.ptr;
-                free(prev->name);
-                free(prev);
+                arena_free(&prog->scratch, prev, sizeof(int_arr_tok_s));
             } else {
-                if (curr->idx_type != INT_VAL_TOK)
-                    free(curr->idx.ptr);
-                free(curr->name);
-                free(curr);
+                arena_free(&prog->scratch, curr, sizeof(int_arr_tok_s));
                 break;
             }
         }
     }
 }
 
-void free_token(void *p)
+/* tokens live in the scratch arena of the program. Freeing one only lets
+ * the arena reuse its memory before the whole arena is released */
+void free_token(program_s *prog, token_s *tok)
 {
-    token_s *tok = (token_s*)p;
-
     if (tok) {
 
-        if ((tok->type == LABEL_TOK) ||
-            (tok->type == INT_VAR_TOK) ||
-            (tok->type == STRING_TOK)) {
-
-            free((void*)tok->data.ptr);
-
-        } else if (tok->type == INT_ARR_TOK) {
-            free_int_arr_tok((int_arr_tok_s*)tok->data.ptr);
+        //names and strings point to the source, so only arrays have data to free
+        if (tok->type == INT_ARR_TOK) {
+            free_int_arr_tok(prog, (int_arr_tok_s*)tok->data.ptr);
         }
 
-        free(tok);
+        arena_free(&prog->scratch, tok, sizeof(token_s));
     }
 }
 
@@ -549,7 +536,15 @@ int call_instruction_handler(program_s *prog, size_t len)
 {
     if (prog && len) {
 
-        KeyValuePair *key = QuadHash_find(instruction_table, (void *)prog->input, len + 1, NULL);
+        char name[MAX_ALLOWED_SYMBOL_LEN + 1];
+
+        ASRT(len <= MAX_ALLOWED_SYMBOL_LEN);
+
+        //the keys of the instruction table are C strings
+        memcpy(name, prog->word, len);
+        name[len] = 0;
+
+        KeyValuePair *key = QuadHash_find(instruction_table, (void *)name, len + 1, NULL);
 
         if (key) {
             instruction_id_e code = *(instruction_id_e*)key->pData;
@@ -561,7 +556,7 @@ int call_instruction_handler(program_s *prog, size_t len)
             return 1;
         } else {
             program_stop(prog, 1);
-            err_msg(prog, "unrecognized instruction\n\t%s\n\t^", prog->input);
+            err_msg(prog, "unrecognized instruction\n\t%s\n\t^", name);
         }
 
     }
@@ -580,7 +575,7 @@ void tokenize_next_line(program_s *prog)
 
     if (is_valid_label(prog, i)) {
 
-        add_new_token(prog, (void*)prog->input, 0, i + 1, LABEL_TOK, 0);
+        add_new_token(prog, prog->word, 0, i, LABEL_TOK, 0);
 
         i = get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1);
 
@@ -606,14 +601,14 @@ void loadstore_handler(program_s *prog, instruction_id_e ins_code)
             return;
         }
 
-        if (!i && (prog->input[0] == '-' || isdigit(prog->input[0]))) {
+        if (!i && (prog->word[0] == '-' || isdigit(prog->word[0]))) {
             program_stop(prog, 1);
             err_msg(prog, "%s instruction expects a variable name as its first argument",
                     instruction_array[ins_code].name_str);
             return;
         }
 
-        if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+        if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
     }
 
     if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
@@ -632,14 +627,14 @@ void set_handler(program_s *prog, instruction_id_e ins_code)
         return;
     }
 
-    if (prog->input[0] == '-' || isdigit(prog->input[0])) {
+    if (prog->word[0] == '-' || isdigit(prog->word[0])) {
         program_stop(prog, 1);
         err_msg(prog, "%s instruction expects a variable name as its first argument",
                 instruction_array[ins_code].name_str);
         return;
     }
 
-    if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+    if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
     if (!get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1)) {
         program_stop(prog, 1);
@@ -648,7 +643,7 @@ void set_handler(program_s *prog, instruction_id_e ins_code)
         return;
     }
 
-    if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+    if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
     if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
         program_stop(prog, 1);
@@ -666,14 +661,14 @@ void primitive_op_handler(program_s *prog, instruction_id_e ins_code)
         return;
     }
 
-    if (prog->input[0] == '-' || isdigit(prog->input[0])) {
+    if (prog->word[0] == '-' || isdigit(prog->word[0])) {
         program_stop(prog, 1);
         err_msg(prog, "%s instruction expects a variable name as its first argument",
                 instruction_array[ins_code].name_str);
         return;
     }
 
-    if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+    if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
     if (!get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1)) {
         program_stop(prog, 1);
@@ -682,7 +677,7 @@ void primitive_op_handler(program_s *prog, instruction_id_e ins_code)
         return;
     }
 
-    if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+    if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
     if (!get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1)) {
         program_stop(prog, 1);
@@ -691,7 +686,7 @@ void primitive_op_handler(program_s *prog, instruction_id_e ins_code)
         return;
     }
 
-    if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+    if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
     if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
         program_stop(prog, 1);
@@ -711,7 +706,7 @@ void branch_handler(program_s *prog, instruction_id_e ins_code)
             return;
         }
 
-        if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+        if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
         if (!get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1)) {
             program_stop(prog, 1);
@@ -720,14 +715,14 @@ void branch_handler(program_s *prog, instruction_id_e ins_code)
             return;
         }
 
-        if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+        if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
     }
 
     size_t i = get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1);
 
     if (is_valid_label(prog, i)) {
 
-        add_new_token(prog, (void*)prog->input, 0, i + 1, LABEL_TOK, 0);
+        add_new_token(prog, prog->word, 0, i, LABEL_TOK, 0);
 
         if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
             program_stop(prog, 1);
@@ -756,14 +751,14 @@ void semaphore_handler(program_s *prog, instruction_id_e ins_code)
         return;
     }
 
-    if (prog->input[0] == '-' || isdigit(prog->input[0])) {
+    if (prog->word[0] == '-' || isdigit(prog->word[0])) {
         program_stop(prog, 1);
         err_msg(prog, "%s instruction expects a global variable as its argument",
                 instruction_array[ins_code].name_str);
         return;
     }
 
-    if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+    if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
     if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
         program_stop(prog, 1);
@@ -781,7 +776,7 @@ void sleep_handler(program_s *prog, instruction_id_e ins_code)
         return;
     }
 
-    if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL)) return;
+    if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
 
     if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
         program_stop(prog, 1);
@@ -802,6 +797,7 @@ void print_handler(program_s *prog, instruction_id_e ins_code)
     }
 
     unsigned int this_line = prog->line;
+    const char *str = &prog->src[prog->src_pos];
     size_t i = 0;
 
     //if we made it up to here then we expect to read a string
@@ -810,31 +806,26 @@ void print_handler(program_s *prog, instruction_id_e ins_code)
 
         if (prog->c == EOF) {
             program_stop(prog, 1);
-            prog->input[i] = 0;
-
-            err_msg(prog, "unexpected EOF encountered while parsing string\n\t%s\n\t^", prog->input);
-
+            err_msg(prog, "unexpected EOF encountered while parsing string\n\t%.*s\n\t^", (int)i, str);
             return;
         }
 
         if (i >= MAX_INPUT_STR_LEN) {
             program_stop(prog, 1);
-            prog->input[i] = 0;
-            err_msg(prog, "string too big to parse; maximum string name length allowed is %zu\n\t%s...\n\t^",
-                    MAX_INPUT_STR_LEN, prog->input);
+            err_msg(prog, "string too big to parse; maximum string name length allowed is %zu\n\t%.*s...\n\t^",
+                    MAX_INPUT_STR_LEN, (int)i, str);
             return;
         }
 
         if (!isprint(prog->c)) {
             program_stop(prog, 1);
-            prog->input[i] = 0;
-            err_msg(prog, "non-printable character with ascii code %d encountered while parsing string\n\t%s\n\t^", prog->c, prog->input);
+            err_msg(prog, "non-printable character with ascii code %d encountered while parsing string\n\t%.*s\n\t^",
+                    prog->c, (int)i, str);
             return;
         }
 
         if (prog->c == '\"') {
-            prog->input[i] = 0;
-            dbg_msg(prog, "parsed string \"%s\"", prog->input);
+            dbg_msg(prog, "parsed string \"%.*s\"", (int)i, str);
 
             NEXT_CHAR(prog);
 
@@ -854,10 +845,10 @@ void print_handler(program_s *prog, instruction_id_e ins_code)
             break;
         }
 
-        prog->input[i++] = prog->c;
+        i++;
     }
 
-    add_new_token(prog, (void*)prog->input, 0, i + 1, STRING_TOK, 0);
+    add_new_token(prog, str, 0, i, STRING_TOK, 0);
 
     if (!flush_up_to_char(prog) || (this_line != prog->line)) {
         if (prog->c == EOF)
@@ -867,8 +858,8 @@ void print_handler(program_s *prog, instruction_id_e ins_code)
 
     while ( (i = get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1)) ) {
 
-        dbg_msg(prog, "parsed %s in the same line as PRINT", prog->input);
-        if (!parse_varval_token(prog, 0, NULL, NULL, 0, NULL))
+        dbg_msg(prog, "parsed %.*s in the same line as PRINT", (int)i, prog->word);
+        if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL))
             break;
 
     }
@@ -879,6 +870,109 @@ void return_handler(program_s *prog, instruction_id_e ins_code)
     (void)ins_code;(void)prog;
 }
 
+void vector_handler(program_s *prog, instruction_id_e ins_code)
+{
+    int arg_cnt = (ins_code == VADD_SYM || ins_code == VSUB_SYM || ins_code == VMUL_SYM) ? 4 : 3;
+
+    for (int i = 0; i < arg_cnt; i++) {
+        if (!get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1)) {
+            program_stop(prog, 1);
+            err_msg(prog, "%s instruction expects %s arguments",
+                    instruction_array[ins_code].name_str, (arg_cnt == 4) ? "four" : "three");
+            return;
+        }
+
+        if (!i && (prog->word[0] == '-' || isdigit(prog->word[0]))) {
+            program_stop(prog, 1);
+            err_msg(prog, "%s instruction expects a variable name as its first argument",
+                    instruction_array[ins_code].name_str);
+            return;
+        }
+
+        if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
+    }
+
+    if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
+        program_stop(prog, 1);
+        err_msg(prog, "more arguments than expected, after %s instruction",
+                instruction_array[ins_code].name_str);
+    }
+}
+
+void atomic_handler(program_s *prog, instruction_id_e ins_code)
+{
+    int arg_cnt = (ins_code == CAS_SYM) ? 4 : 3;
+
+    for (int i = 0; i < arg_cnt; i++) {
+        if (!get_next_word(prog, MAX_ALLOWED_SYMBOL_LEN, 1)) {
+            program_stop(prog, 1);
+            err_msg(prog, "%s instruction expects %s arguments",
+                    instruction_array[ins_code].name_str, (arg_cnt == 4) ? "four" : "three");
+            return;
+        }
+
+        if (i < 2 && (prog->word[0] == '-' || isdigit(prog->word[0]))) {
+            program_stop(prog, 1);
+            err_msg(prog, "%s instruction expects a variable name as its %s argument",
+                    instruction_array[ins_code].name_str, i ? "second" : "first");
+            return;
+        }
+
+        if (!parse_varval_token(prog, 0, NULL, NULL, NULL, 0, NULL)) return;
+    }
+
+    if (flush_up_to_newline(prog) == LINE_NOT_EMPTY) {
+        program_stop(prog, 1);
+        err_msg(prog, "more arguments than expected, after %s instruction",
+                instruction_array[ins_code].name_str);
+    }
+}
+
+/* the name of an instruction that can appear in the source */
+const char *lexer_instruction_name(instruction_id_e code)
+{
+    ASRT((size_t)code < ARRAY_LEN(instruction_array));
+
+    return instruction_array[code].name_str;
+}
+
+/* maps the source file of the program to memory, so that the scanner
+ * can read it directly and tokens can point to it */
+void lexer_map_source(program_s *prog)
+{
+    struct stat st;
+    int fd;
+
+    ERR(fd = open(prog->fname, O_RDONLY), fd == -1);
+    ERR(int stat_ret = fstat(fd, &st), stat_ret == -1);
+
+    prog->src = NULL;
+    prog->src_len = (size_t)st.st_size;
+    prog->src_pos = 0;
+
+    //empty files can't be mapped
+    if (prog->src_len) {
+        void *src;
+
+        ERR(src = mmap(NULL, prog->src_len, PROT_READ, MAP_PRIVATE, fd, 0), src == MAP_FAILED);
+        (void)madvise(src, prog->src_len, MADV_SEQUENTIAL);
+
+        prog->src = (const char*)src;
+    }
+
+    close(fd);
+}
+
+void lexer_unmap_source(program_s *prog)
+{
+    if (prog->src) {
+        munmap((void*)prog->src, prog->src_len);
+    }
+
+    prog->src = prog->word = NULL;
+    prog->src_len = prog->src_pos = prog->word_len = 0;
+}
+
 void lexer_init(void)
 {
     if (!lexer_initialized) {
@@ -4,6 +4,25 @@
 #include "common.h"
 #include "program.h"
 
+
+/* temporarily move the parser position to the position of a token,
+ * so that error messages point at it */
+#define SET_PARSER_IDX(prog, tok) \
+do { \
+    unsigned int ___tmp_line = prog->line, \
+                 ___tmp_col = prog->column, \
+                 ___tmp_prev_col = prog->prev_col; \
+    prog->line = tok->line; \
+    prog->column = tok->column; \
+    prog->prev_col = tok->prev_col \
+
+#define RESET_PARSER_IDX(prog) \
+    prog->line = ___tmp_line; \
+    prog->column = ___tmp_col; \
+    prog->prev_col = ___tmp_prev_col; \
+} while (0)
+
+
 typedef enum _token_type_e {
     LABEL_TOK,
     INSTRUCTION_TOK,
@@ -23,20 +42,23 @@ typedef struct _token_s {
     size_t len;
     token_type_e type;
     unsigned int line, column, prev_col;
-    long offset; //only used for labels (bad design choice)
 } token_s;
 
 typedef struct _int_arr_tok_s {
     varval_u idx;
+    size_t idx_len;
     token_type_e idx_type;
-    char *name;
+    const char *name; //points to the source, isn't NUL terminated
+    size_t name_len;
 } int_arr_tok_s;
 
 
 void lexer_init(void);
 void lexer_destroy(void);
+void lexer_map_source(program_s *prog);
+void lexer_unmap_source(program_s *prog);
 void parse_magic(program_s *prog);
 void tokenize_next_line(program_s *prog);
-void free_token(void *p);
+void free_token(program_s *prog, token_s *tok);
 
 #endif //SIMBLY_SCANNER_H__
@@ -0,0 +1,196 @@
+#include "vector.h"
+#include <limits.h>
+
+/* GCC and Clang can build kernels for instruction sets that the rest of the
+ * interpreter isn't compiled for, and check for them when it starts */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(SIMBLY_NO_SIMD)
+# define SIMBLY_X86_SIMD
+# include <immintrin.h>
+#endif
+
+//arithmetic on unsigned integers, so that overflow wraps around instead of being undefined
+#define S_ADD(a, b) ((int)((unsigned int)(a) + (unsigned int)(b)))
+#define S_SUB(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)))
+#define S_MUL(a, b) ((int)((unsigned int)(a) * (unsigned int)(b)))
+#define S_MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define S_MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+const vector_kernels_s *vector_kernels;
+
+
+
+/* the scalar kernels, for every CPU, and for the elements at the end of a
+ * range that don't fill a vector register */
+#define SCALAR_BINARY(name, sop) \
+static void name##_scalar(int *dst, const int *a, const int *b, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) \
+        dst[i] = sop(a[i], b[i]); \
+} \
+\
+static void name##_broadcast_scalar(int *dst, const int *a, int b, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) \
+        dst[i] = sop(a[i], b); \
+}
+
+#define SCALAR_REDUCE(name, sop) \
+static int name##_scalar(int acc, const int *a, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) \
+        acc = sop(acc, a[i]); \
+    return acc; \
+}
+
+SCALAR_BINARY(add, S_ADD)
+SCALAR_BINARY(sub, S_SUB)
+SCALAR_BINARY(mul, S_MUL)
+SCALAR_REDUCE(sum, S_ADD)
+SCALAR_REDUCE(min, S_MIN)
+SCALAR_REDUCE(max, S_MAX)
+
+static void fill_scalar(int *dst, int val, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = val;
+}
+
+static const vector_kernels_s scalar_kernels = {
+    "scalar",
+    {add_scalar, sub_scalar, mul_scalar},
+    {add_broadcast_scalar, sub_broadcast_scalar, mul_broadcast_scalar},
+    fill_scalar,
+    {sum_scalar, min_scalar, max_scalar}
+};
+
+
+#ifdef SIMBLY_X86_SIMD
+
+/* kernels of an instruction set, with vec_t registers of width integers. Each
+ * one runs the vector operation on as many integers as it can, and leaves
+ * the rest to the scalar kernel */
+#define SIMD_BINARY(isa, name, vop) \
+__attribute__((target(isa##_TARGET))) \
+static void name##_##isa(int *dst, const int *a, const int *b, size_t n) \
+{ \
+    size_t i = 0; \
+    for (; i + isa##_WIDTH <= n; i += isa##_WIDTH) \
+        isa##_STORE(dst + i, vop(isa##_LOAD(a + i), isa##_LOAD(b + i))); \
+    name##_scalar(dst + i, a + i, b + i, n - i); \
+} \
+\
+__attribute__((target(isa##_TARGET))) \
+static void name##_broadcast_##isa(int *dst, const int *a, int b, size_t n) \
+{ \
+    isa##_VEC vb = isa##_SET1(b); \
+    size_t i = 0; \
+    for (; i + isa##_WIDTH <= n; i += isa##_WIDTH) \
+        isa##_STORE(dst + i, vop(isa##_LOAD(a + i), vb)); \
+    name##_broadcast_scalar(dst + i, a + i, b, n - i); \
+}
+
+#define SIMD_REDUCE(isa, name, vop, init) \
+__attribute__((target(isa##_TARGET))) \
+static int name##_##isa(int acc, const int *a, size_t n) \
+{ \
+    isa##_VEC vacc = isa##_SET1(init); \
+    int lanes[isa##_WIDTH]; \
+    size_t i = 0; \
+    for (; i + isa##_WIDTH <= n; i += isa##_WIDTH) \
+        vacc = vop(vacc, isa##_LOAD(a + i)); \
+    isa##_STORE(lanes, vacc); \
+    for (size_t j = 0; j < isa##_WIDTH; j++) \
+        acc = name##_scalar(acc, &lanes[j], 1); \
+    return name##_scalar(acc, a + i, n - i); \
+}
+
+#define SIMD_FILL(isa) \
+__attribute__((target(isa##_TARGET))) \
+static void fill_##isa(int *dst, int val, size_t n) \
+{ \
+    isa##_VEC v = isa##_SET1(val); \
+    size_t i = 0; \
+    for (; i + isa##_WIDTH <= n; i += isa##_WIDTH) \
+        isa##_STORE(dst + i, v); \
+    fill_scalar(dst + i, val, n - i); \
+}
+
+#define SIMD_KERNELS(isa) \
+    SIMD_BINARY(isa, add, isa##_ADD) \
+    SIMD_BINARY(isa, sub, isa##_SUB) \
+    SIMD_BINARY(isa, mul, isa##_MUL) \
+    SIMD_REDUCE(isa, sum, isa##_ADD, 0) \
+    SIMD_REDUCE(isa, min, isa##_MIN, INT_MAX) \
+    SIMD_REDUCE(isa, max, isa##_MAX, INT_MIN) \
+    SIMD_FILL(isa) \
+\
+static const vector_kernels_s isa##_kernels = { \
+    #isa, \
+    {add_##isa, sub_##isa, mul_##isa}, \
+    {add_broadcast_##isa, sub_broadcast_##isa, mul_broadcast_##isa}, \
+    fill_##isa, \
+    {sum_##isa, min_##isa, max_##isa} \
+};
+
+/* SSE2 has no 32 bit multiplication that keeps the low half, or 32 bit
+ * min/max, so those are made out of other instructions */
+#define sse2_TARGET "sse2"
+#define sse2_WIDTH 4
+#define sse2_VEC __m128i
+#define sse2_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define sse2_STORE(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define sse2_SET1(x) _mm_set1_epi32(x)
+#define sse2_ADD(a, b) _mm_add_epi32((a), (b))
+#define sse2_SUB(a, b) _mm_sub_epi32((a), (b))
+#define sse2_MUL(a, b) mul_lanes_sse2((a), (b))
+#define sse2_MIN(a, b) blend_sse2(_mm_cmpgt_epi32((a), (b)), (b), (a))
+#define sse2_MAX(a, b) blend_sse2(_mm_cmpgt_epi32((a), (b)), (a), (b))
+
+__attribute__((target("sse2")))
+static __m128i mul_lanes_sse2(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+//the lanes of a where mask is set, and the lanes of b everywhere else
+__attribute__((target("sse2")))
+static __m128i blend_sse2(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+#define avx2_TARGET "avx2"
+#define avx2_WIDTH 8
+#define avx2_VEC __m256i
+#define avx2_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define avx2_STORE(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define avx2_SET1(x) _mm256_set1_epi32(x)
+#define avx2_ADD(a, b) _mm256_add_epi32((a), (b))
+#define avx2_SUB(a, b) _mm256_sub_epi32((a), (b))
+#define avx2_MUL(a, b) _mm256_mullo_epi32((a), (b))
+#define avx2_MIN(a, b) _mm256_min_epi32((a), (b))
+#define avx2_MAX(a, b) _mm256_max_epi32((a), (b))
+
+SIMD_KERNELS(sse2)
+SIMD_KERNELS(avx2)
+
+#endif //SIMBLY_X86_SIMD
+
+void vector_init(void)
+{
+    vector_kernels = &scalar_kernels;
+
+#ifdef SIMBLY_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        vector_kernels = &avx2_kernels;
+    } else if (__builtin_cpu_supports("sse2")) {
+        vector_kernels = &sse2_kernels;
+    }
+#endif
+}
@@ -0,0 +1,39 @@
+#ifndef SIMBLY_VECTOR_H__
+#define SIMBLY_VECTOR_H__
+
+#include "common.h"
+
+
+typedef enum _vector_op_e {
+    VECTOR_ADD,
+    VECTOR_SUB,
+    VECTOR_MUL,
+    VECTOR_OP_CNT
+} vector_op_e;
+
+typedef enum _vector_reduce_e {
+    VECTOR_SUM,
+    VECTOR_MIN,
+    VECTOR_MAX,
+    VECTOR_REDUCE_CNT
+} vector_reduce_e;
+
+/* kernels that work on n contiguous integers. Arithmetic wraps around on
+ * overflow, like it does for the scalar instructions. dst can be the same
+ * as a or b, or come before them in memory, but not after them */
+typedef struct _vector_kernels_s {
+    const char *name;
+    void (*binary[VECTOR_OP_CNT])(int *dst, const int *a, const int *b, size_t n);
+    void (*broadcast[VECTOR_OP_CNT])(int *dst, const int *a, int b, size_t n);
+    void (*fill)(int *dst, int val, size_t n);
+    //folds the n integers into acc
+    int (*reduce[VECTOR_REDUCE_CNT])(int acc, const int *a, size_t n);
+} vector_kernels_s;
+
+
+/* the best kernels for the CPU the interpreter runs on, picked by vector_init() */
+extern const vector_kernels_s *vector_kernels;
+
+void vector_init(void);
+
+#endif //SIMBLY_VECTOR_H__